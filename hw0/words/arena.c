@@ -0,0 +1,70 @@
+/*
+
+arena provides bump-pointer allocation of many small objects that are all
+freed together.
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+
+/* Size of a block, unless a single allocation needs more */
+#define ARENA_BLOCK_SIZE (64 * 1024)
+
+struct arena_block {
+    struct arena_block *next;
+    size_t used;
+    size_t size;
+    max_align_t data[];
+};
+
+void arena_init(Arena *arena) {
+    arena->head = NULL;
+    arena->nblocks = 0;
+}
+
+void *arena_alloc(Arena *arena, size_t size) {
+    struct arena_block *block = arena->head;
+    size_t align = sizeof(max_align_t);
+    size = (size + align - 1) / align * align;
+
+    if (block == NULL || block->size - block->used < size) {
+        size_t block_size = size > ARENA_BLOCK_SIZE ? size : ARENA_BLOCK_SIZE;
+        block = malloc(sizeof(struct arena_block) + block_size);
+        if (block == NULL) {
+            perror("malloc");
+            return NULL;
+        }
+        block->next = arena->head;
+        block->used = 0;
+        block->size = block_size;
+        arena->head = block;
+        arena->nblocks++;
+    }
+
+    void *p = (char *) block->data + block->used;
+    block->used += size;
+    return p;
+}
+
+char *arena_strndup(Arena *arena, const char *str, size_t len) {
+    char *copy = arena_alloc(arena, len + 1);
+    if (copy != NULL) {
+        memcpy(copy, str, len);
+        copy[len] = '\0';
+    }
+    return copy;
+}
+
+void arena_free(Arena *arena) {
+    struct arena_block *block = arena->head;
+    while (block != NULL) {
+        struct arena_block *next = block->next;
+        free(block);
+        block = next;
+    }
+    arena_init(arena);
+}
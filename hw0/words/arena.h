@@ -0,0 +1,31 @@
+/*
+
+arena provides bump-pointer allocation of many small objects that are all
+freed together.
+
+*/
+
+#ifndef arena_h
+#define arena_h
+
+#include <stddef.h>
+
+/* A chain of large blocks; allocations are carved from the newest one */
+typedef struct arena {
+    struct arena_block *head;
+    size_t nblocks;
+} Arena;
+
+/* Initialize an empty arena */
+void arena_init(Arena *arena);
+
+/* Allocate size bytes, aligned for any type. Returns NULL if out of memory. */
+void *arena_alloc(Arena *arena, size_t size);
+
+/* Copy the len bytes at str plus a terminating null into the arena */
+char *arena_strndup(Arena *arena, const char *str, size_t len);
+
+/* Free every allocation in the arena at once, leaving it empty */
+void arena_free(Arena *arena);
+
+#endif /* arena_h */
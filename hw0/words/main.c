@@ -100,75 +100,29 @@ int num_words(FILE* infile) {
  * Useful functions: fgetc(), isalpha(), tolower(), add_word().
  */
 void count_words(WordCount **wclist, FILE *infile) {
-  
-  bool isword;
-  int len;
-  char ch;
-  size_t size = 64;
-
-  char * buf = malloc((sizeof(char) * size) + 1);
-  if (buf == NULL) {
-        perror("malloc");
-        return;
-  }
-
-  ch = fgetc(infile);
-
-  while (ch != EOF) {
-
-        //Skip the whitespace lmao
-        while (ch == ' ' || ch == '\n' || ch == '\t') {
-                ch = fgetc(infile);
-                if (ch == EOF) {
-			free(buf);
-                        return;
-                }
-        }
-
-        //Get the word, if word is invalid then don't add anything
-        isword = true;
-        len = 0;
-        while (!(ch == ' ' || ch == '\n' || ch == '\t')) {
-
-                if (ch == EOF) {
-
-                        if (isword && len > 1 && len <= MAX_WORD_LEN) {
-				add_word(wclist, buf);
-				buf = malloc((sizeof(char) * size) + 1);
-  				if (buf == NULL) {
-        				perror("malloc");
-        				return;
-  				}
-                        }
-
-			free(buf);
-                        return;
-                }
-
-                if (!isalpha(ch)) {
-			ch = fgetc(infile);
-                        break;
-                }
-
-		if (len <= MAX_WORD_LEN) {
-			buf[len] = tolower(ch);
-		}
-
-                ch = fgetc(infile);
-                len++;
-        }
-
-        if (isword && len > 1 && len <= MAX_WORD_LEN) {
-                add_word(wclist, buf);
-                buf = malloc((sizeof(char) * size) + 1);
-                if (buf == NULL) {
-			perror("malloc");
-                        return;
-                }
-        }
-  }
-
-  return;
+  /*
+   * Words are collected in a stack buffer; add_word copies a word only the
+   * first time it is seen, so repeated words cost no allocation at all.
+   */
+  char buf[MAX_WORD_LEN + 1];
+  int len = 0;
+  int ch;
+
+  do {
+    ch = fgetc(infile);
+    if (ch != EOF && isalpha(ch)) {
+      if (len < MAX_WORD_LEN) {
+        buf[len] = tolower(ch);
+      }
+      len++;
+    } else {
+      if (len > 1 && len <= MAX_WORD_LEN) {
+        buf[len] = '\0';
+        add_word(wclist, buf);
+      }
+      len = 0;
+    }
+  } while (ch != EOF);
 }
 
 /*
@@ -280,6 +234,8 @@ int main (int argc, char *argv[]) {
 
     printf("The frequencies of each word are: \n");
     fprint_words(word_counts, stdout);
-}
+  }
+
+  free_words(&word_counts);
   return 0;
 }
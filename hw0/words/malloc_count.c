@@ -0,0 +1,66 @@
+/*
+
+  malloc_count - LD_PRELOAD shim reporting the allocator use of a program.
+
+  Build with `make malloc_count.so` and run e.g.
+
+      LD_PRELOAD=./malloc_count.so ./words -f file...
+
+  At exit it prints to stderr the number of malloc/calloc/realloc calls, the
+  peak resident set size and the elapsed wall-clock and CPU time. It wraps
+  glibc's internal allocator entry points, so it needs glibc.
+
+*/
+
+#include <stdio.h>
+#include <stddef.h>
+#include <sys/resource.h>
+#include <time.h>
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+
+static unsigned long mallocs;
+static unsigned long callocs;
+static unsigned long reallocs;
+static struct timespec start;
+
+void *malloc(size_t size) {
+  __atomic_fetch_add(&mallocs, 1, __ATOMIC_RELAXED);
+  return __libc_malloc(size);
+}
+
+void *calloc(size_t nmemb, size_t size) {
+  __atomic_fetch_add(&callocs, 1, __ATOMIC_RELAXED);
+  return __libc_calloc(nmemb, size);
+}
+
+void *realloc(void *ptr, size_t size) {
+  __atomic_fetch_add(&reallocs, 1, __ATOMIC_RELAXED);
+  return __libc_realloc(ptr, size);
+}
+
+__attribute__((constructor))
+static void malloc_count_start(void) {
+  clock_gettime(CLOCK_MONOTONIC, &start);
+}
+
+__attribute__((destructor))
+static void malloc_count_report(void) {
+  struct timespec end;
+  struct rusage ru;
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  getrusage(RUSAGE_SELF, &ru);
+
+  double wall = (end.tv_sec - start.tv_sec) +
+                (end.tv_nsec - start.tv_nsec) / 1e9;
+  double cpu = ru.ru_utime.tv_sec + ru.ru_stime.tv_sec +
+               (ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) / 1e6;
+  fprintf(stderr,
+          "allocations: %lu (malloc %lu, calloc %lu, realloc %lu)\n"
+          "max RSS: %ld KB\n"
+          "time: %.3f s wall, %.3f s cpu\n",
+          mallocs + callocs + reallocs, mallocs, callocs, reallocs,
+          ru.ru_maxrss, wall, cpu);
+}
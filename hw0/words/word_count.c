@@ -21,6 +21,10 @@ Mutators take a reference to a list as first arg.
 */
 
 #include "word_count.h"
+#include "arena.h"
+
+/* Backing store for every WordCount node and the word it holds */
+static Arena word_arena;
 
 /* Basic utililties */
 
@@ -61,18 +65,24 @@ void add_word(WordCount **wclist, char *word) {
 	return;
   }
 
-  WordCount * nwc = malloc(sizeof(WordCount));
+  /* Allocate the node and its word together from the arena */
+  size_t len = strlen(word);
+  WordCount * nwc = arena_alloc(&word_arena, sizeof(WordCount) + len + 1);
   if (nwc == NULL) {
-	  perror("malloc");
 	  return;
   }
 
   nwc->count = 1;
-  nwc->word = word;
+  nwc->word = memcpy((char *) (nwc + 1), word, len + 1);
   nwc->next = *wclist;
   *wclist = nwc;
 }
 
+void free_words(WordCount **wclist) {
+  arena_free(&word_arena);
+  init_words(wclist);
+}
+
 void fprint_words(WordCount *wchead, FILE *ofile) {
   /* print word counts to a file */
   WordCount *wc;
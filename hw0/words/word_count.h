@@ -55,9 +55,13 @@ size_t len_words(WordCount *wchead);
 /* Find a word in a word_count list */
 WordCount *find_word(WordCount *wchead, char *word);
 
-/* Insert word with count=1, if not already present; increment count if present. */
+/* Insert word with count=1, if not already present; increment count if present.
+   A new word is copied into the list's arena, so the caller keeps ownership. */
 void add_word(WordCount **wclist, char *word);
 
+/* Free every word and node of a word count list at once, leaving it empty */
+void free_words(WordCount **wclist);
+
 //static int wordcntcmp(const WordCount *wc1, WordCount *wc2);
 
 /* print word counts to a file */
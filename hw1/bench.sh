@@ -0,0 +1,62 @@
+#!/bin/sh
+#
+# Times each word counting command given on the command line over the same
+# input files and checks that they all print the same counts. A command may
+# carry its own flags if quoted, e.g. "./pwords -j 4".
+#
+# Usage: ./bench.sh [-n runs] command... [-- file...]
+# Files default to gutenberg/*.txt.
+
+runs=3
+if [ "$1" = "-n" ]; then
+  runs=$2
+  shift 2
+fi
+
+nl='
+'
+cmds=""
+while [ $# -gt 0 ] && [ "$1" != "--" ]; do
+  cmds="$cmds$1$nl"
+  shift
+done
+[ "$1" = "--" ] && shift
+[ $# -eq 0 ] && set -- "$(dirname "$0")"/gutenberg/*.txt
+
+if [ -z "$cmds" ]; then
+  echo "usage: $0 [-n runs] command... [-- file...]" >&2
+  exit 2
+fi
+
+out=$(mktemp -d)
+trap 'rm -rf "$out"' EXIT
+
+ref=""
+status=0
+IFS=$nl
+for cmd in $cmds; do
+  IFS=' '
+  name=$(echo "$cmd" | sed 's|[^ ]*/||g')
+  out_file="$out/$(echo "$name" | tr ' ' _)"
+  best=""
+  i=0
+  while [ $i -lt "$runs" ]; do
+    start=$(date +%s%N)
+    $cmd "$@" > "$out_file"
+    end=$(date +%s%N)
+    ms=$(( (end - start) / 1000000 ))
+    if [ -z "$best" ] || [ $ms -lt "$best" ]; then
+      best=$ms
+    fi
+    i=$((i + 1))
+  done
+  printf "%-16s %8d ms (best of %d)\n" "$name" "$best" "$runs"
+  if [ -z "$ref" ]; then
+    ref=$name
+    ref_file=$out_file
+  elif ! cmp -s "$ref_file" "$out_file"; then
+    echo "  output of $name differs from $ref" >&2
+    status=1
+  fi
+done
+exit $status
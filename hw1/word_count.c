@@ -65,6 +65,51 @@ word_count_t *add_word(word_count_list_t *wclist, char *word) {
   return wc;
 }
 
+word_count_t *add_word_len(word_count_list_t *wclist, const char *word,
+                           size_t len) {
+  /* Make an owned, terminated copy and hand it to add_word. */
+  word_count_t *wc = NULL;
+  char *copy = malloc(len + 1);
+  if (copy == NULL) {
+    perror("malloc");
+  } else {
+    memcpy(copy, word, len);
+    copy[len] = '\0';
+    if ((wc = add_word(wclist, copy)) == NULL) {
+      free(copy);
+    }
+  }
+  return wc;
+}
+
+bool merge_words(word_count_list_t *dst, word_count_list_t *src) {
+  /* Move each entry of src into dst, folding duplicates into dst's entry. */
+  word_count_t *wc = *src;
+  while (wc != NULL) {
+    word_count_t *next = wc->next;
+    word_count_t *existing = find_word(dst, wc->word);
+    if (existing != NULL) {
+      existing->count += wc->count;
+      free(wc->word);
+      free(wc);
+    } else {
+      wc->next = *dst;
+      *dst = wc;
+    }
+    wc = next;
+  }
+  *src = NULL;
+  return true;
+}
+
+void foreach_word(word_count_list_t *wclist,
+                  void fn(word_count_t *, void *), void *aux) {
+  word_count_t *wc;
+  for (wc = *wclist; wc != NULL; wc = wc->next) {
+    fn(wc, aux);
+  }
+}
+
 void fprint_words(word_count_list_t *wclist, FILE *outfile) {
   word_count_t *wc;
   for (wc = *wclist; wc != NULL; wc = wc->next) {
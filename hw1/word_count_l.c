@@ -72,6 +72,47 @@ word_count_t *add_word(word_count_list_t *wclist, char *word) {
   return add_word_with_count(wclist, word, 1);
 }
 
+word_count_t *add_word_len(word_count_list_t *wclist, const char *word,
+                           size_t len) {
+  /* Make an owned, terminated copy and hand it to add_word. */
+  word_count_t *wc = NULL;
+  char *copy = malloc(len + 1);
+  if (copy == NULL) {
+    perror("malloc");
+  } else {
+    memcpy(copy, word, len);
+    copy[len] = '\0';
+    if ((wc = add_word(wclist, copy)) == NULL) {
+      free(copy);
+    }
+  }
+  return wc;
+}
+
+bool merge_words(word_count_list_t *dst, word_count_list_t *src) {
+  /* Move each entry of src into dst, folding duplicates into dst's entry. */
+  while (!list_empty(src)) {
+    word_count_t *wc = list_entry(list_pop_front(src), word_count_t, elem);
+    word_count_t *existing = find_word(dst, wc->word);
+    if (existing != NULL) {
+      existing->count += wc->count;
+      free(wc->word);
+      free(wc);
+    } else {
+      list_push_front(dst, &wc->elem);
+    }
+  }
+  return true;
+}
+
+void foreach_word(word_count_list_t *wclist,
+                  void fn(word_count_t *, void *), void *aux) {
+  struct list_elem *e;
+  for (e = list_begin(wclist); e != list_end(wclist); e = list_next(e)) {
+    fn(list_entry(e, word_count_t, elem), aux);
+  }
+}
+
 void fprint_words(word_count_list_t *wclist, FILE *outfile) {
   struct list_elem * e;
   for (e = list_begin(wclist); e != list_end(wclist); e = list_next(e)) {
@@ -24,9 +24,12 @@
 
 #include <ctype.h>
 #include <stdio.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "word_count.h"
 #include "word_helpers.h"
+#include "word_scan.h"
 
 /*
  * Reads a word from a stream, skipping initial non-alpha characters, and
@@ -75,10 +78,47 @@ static size_t get_word(char **word, FILE *infile) {
   return index;
 }
 
+static void count_word(const char *word, size_t len, void *wclist) {
+  if (len > 1) {
+    add_word_len(wclist, word, len);
+  }
+}
+
+void count_words_buf(word_count_list_t *wclist, const char *data, size_t len) {
+  scan_words(data, len, count_word, wclist);
+}
+
+/*
+ * Counts a regular file that has not been read from yet by mapping it and
+ * running the word scanner over it. Returns false if infile can't be mapped.
+ */
+static bool count_words_mapped(word_count_list_t *wclist, FILE *infile) {
+  struct stat st;
+  int fd = fileno(infile);
+  if (fd < 0 || fstat(fd, &st) < 0 || !S_ISREG(st.st_mode) ||
+      ftell(infile) != 0) {
+    return false;
+  }
+  if (st.st_size == 0) {
+    return true;
+  }
+  void *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (data == MAP_FAILED) {
+    return false;
+  }
+  count_words_buf(wclist, data, st.st_size);
+  munmap(data, st.st_size);
+  return true;
+}
+
 void count_words(word_count_list_t *wclist, FILE *infile) {
   /* Extract all words in infile and update word counts for them. */
   char *word;
   size_t len;
+
+  if (count_words_mapped(wclist, infile)) {
+    return;
+  }
   while ((len = get_word(&word, infile)) != 0) {
     if (len == 1) {
       free(word);
@@ -89,6 +129,170 @@ void count_words(word_count_list_t *wclist, FILE *infile) {
   }
 }
 
+#define OUT_BUFFER_SIZE (64 * 1024)
+
+/* An output buffer that is flushed to a stream only when full. */
+struct out_buffer {
+  FILE *outfile;
+  size_t used;
+  char data[OUT_BUFFER_SIZE];
+};
+
+static void out_flush(struct out_buffer *out) {
+  fwrite(out->data, 1, out->used, out->outfile);
+  out->used = 0;
+}
+
+/* Appends one entry formatted as "%8d\t%s\n". */
+static void out_entry(word_count_t *wc, void *aux) {
+  struct out_buffer *out = aux;
+  size_t len = strlen(wc->word);
+  char digits[16];
+  int n = 0;
+  unsigned int count = wc->count < 0 ? -(unsigned int) wc->count : wc->count;
+
+  do {
+    digits[n++] = '0' + count % 10;
+    count /= 10;
+  } while (count != 0);
+  if (wc->count < 0) {
+    digits[n++] = '-';
+  }
+
+  /* Padding, digits, tab, word and newline. */
+  size_t need = (n < 8 ? 8 : n) + 1 + len + 1;
+  if (out->used + need > OUT_BUFFER_SIZE) {
+    out_flush(out);
+    if (need > OUT_BUFFER_SIZE) {
+      fprintf(out->outfile, "%8d\t%s\n", wc->count, wc->word);
+      return;
+    }
+  }
+  char *p = out->data + out->used;
+  for (int i = n; i < 8; i++) {
+    *p++ = ' ';
+  }
+  while (n > 0) {
+    *p++ = digits[--n];
+  }
+  *p++ = '\t';
+  memcpy(p, wc->word, len);
+  p += len;
+  *p++ = '\n';
+  out->used = p - out->data;
+}
+
+void fprint_words_bulk(word_count_list_t *wclist, FILE *outfile) {
+  struct out_buffer *out = malloc(sizeof *out);
+  if (out == NULL) {
+    perror("malloc");
+    fprint_words(wclist, outfile);
+    return;
+  }
+  out->outfile = outfile;
+  out->used = 0;
+  foreach_word(wclist, out_entry, out);
+  out_flush(out);
+  free(out);
+}
+
+/* A min-heap holding the k greatest entries seen so far. */
+struct top_heap {
+  word_count_t **heap;
+  size_t size;
+  size_t k;
+  bool (*less)(const word_count_t *, const word_count_t *);
+};
+
+static void sift_down(struct top_heap *h, size_t i) {
+  for (;;) {
+    size_t min = i;
+    size_t l = 2 * i + 1;
+    size_t r = l + 1;
+    if (l < h->size && h->less(h->heap[l], h->heap[min])) {
+      min = l;
+    }
+    if (r < h->size && h->less(h->heap[r], h->heap[min])) {
+      min = r;
+    }
+    if (min == i) {
+      return;
+    }
+    word_count_t *tmp = h->heap[i];
+    h->heap[i] = h->heap[min];
+    h->heap[min] = tmp;
+    i = min;
+  }
+}
+
+static void top_offer(word_count_t *wc, void *aux) {
+  struct top_heap *h = aux;
+  if (h->size < h->k) {
+    /* Sift up. */
+    size_t i = h->size++;
+    while (i > 0 && h->less(wc, h->heap[(i - 1) / 2])) {
+      h->heap[i] = h->heap[(i - 1) / 2];
+      i = (i - 1) / 2;
+    }
+    h->heap[i] = wc;
+  } else if (h->less(h->heap[0], wc)) {
+    h->heap[0] = wc;
+    sift_down(h, 0);
+  }
+}
+
+/* Prints the entries after the first skip, for the fallback below. */
+struct top_tail {
+  FILE *outfile;
+  size_t skip;
+};
+
+static void tail_entry(word_count_t *wc, void *aux) {
+  struct top_tail *t = aux;
+  if (t->skip > 0) {
+    t->skip--;
+  } else {
+    fprintf(t->outfile, "%8d\t%s\n", wc->count, wc->word);
+  }
+}
+
+void fprint_top_words(word_count_list_t *wclist, FILE *outfile, size_t k,
+                      bool less(const word_count_t *, const word_count_t *)) {
+  struct top_heap h = { NULL, 0, k, less };
+  struct out_buffer *out;
+  size_t len = len_words(wclist);
+  if (k > len) {
+    h.k = k = len;
+  }
+  if (k == 0) {
+    return;
+  }
+  if ((h.heap = malloc(k * sizeof *h.heap)) == NULL ||
+      (out = malloc(sizeof *out)) == NULL) {
+    /* Fall back to sorting the whole list, like fprint_words_bulk. */
+    struct top_tail t = { outfile, len - k };
+    perror("malloc");
+    free(h.heap);
+    wordcount_sort(wclist, less);
+    foreach_word(wclist, tail_entry, &t);
+    return;
+  }
+  foreach_word(wclist, top_offer, &h);
+
+  /* Popping the min-heap yields the entries in ascending order. */
+  out->outfile = outfile;
+  out->used = 0;
+  while (h.size > 0) {
+    word_count_t *min = h.heap[0];
+    h.heap[0] = h.heap[--h.size];
+    sift_down(&h, 0);
+    out_entry(min, out);
+  }
+  out_flush(out);
+  free(out);
+  free(h.heap);
+}
+
 bool less_count(const word_count_t * wc1, const word_count_t * wc2) {
   return (wc1->count < wc2->count) ||
          ((wc1->count == wc2->count) && (strcmp(wc1->word, wc2->word) < 0));
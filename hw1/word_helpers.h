@@ -36,6 +36,27 @@
  */
 void count_words(word_count_list_t *wclist, FILE *infile);
 
+/*
+ * Counts all words in the buffer data[0..len) into a word count list, without
+ * allocating per word.
+ */
+void count_words_buf(word_count_list_t *wclist, const char *data, size_t len);
+
+/*
+ * Prints word counts to a file like fprint_words, but formats them into a
+ * large buffer that is written out in bulk.
+ */
+void fprint_words_bulk(word_count_list_t *wclist, FILE *outfile);
+
+/*
+ * Prints the k entries of a word count list that are greatest according to
+ * less, in ascending order, without sorting the rest of the list. The output
+ * matches the last k lines of the list printed after wordcount_sort, which it
+ * falls back to if it cannot allocate its heap.
+ */
+void fprint_top_words(word_count_list_t *wclist, FILE *outfile, size_t k,
+                      bool less(const word_count_t *, const word_count_t *));
+
 /*
  * Returns true if the first entry has a lower count than the second entry,
  * breaking ties according to alphabetical order.
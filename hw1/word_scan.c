@@ -0,0 +1,216 @@
+/*
+ * Implementation of the word_scan interface.
+ *
+ * Input is processed in windows. Each window is copied into a scratch buffer
+ * 64 bytes at a time by a kernel that lowercases letters, replaces every
+ * other byte with '\0', and returns a bitmask of which bytes were letters.
+ * Word boundaries are the 0/1 transitions in that mask, found with
+ * count-trailing-zeros, so long runs of letters or of separators are skipped
+ * a whole mask at a time. Because separators become '\0', every word in the
+ * scratch buffer is already a terminated string. A word cut off at the end
+ * of a window is moved to the front of the buffer and finished in the next.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#ifdef __SSE2__
+#include <immintrin.h>
+#endif
+
+#include "word_scan.h"
+
+#define SCAN_WINDOW (64 * 1024)
+#define KERNEL_BYTES 64
+
+/* Lowercases IN[0..KERNEL_BYTES) into OUT as described above. */
+typedef uint64_t kernel_fn(char *out, const char *in);
+
+static enum scan_impl forced_impl = SCAN_AUTO;
+
+/* Scalar version of a kernel, for N <= KERNEL_BYTES bytes. */
+static uint64_t lower_scalar_n(char *out, const char *in, size_t n) {
+  uint64_t mask = 0;
+  for (size_t i = 0; i < n; i++) {
+    unsigned char c = in[i] | 0x20;
+    bool alpha = (unsigned char) (c - 'a') < 26;
+    out[i] = alpha ? c : '\0';
+    mask |= (uint64_t) alpha << i;
+  }
+  return mask;
+}
+
+static uint64_t lower_scalar(char *out, const char *in) {
+  return lower_scalar_n(out, in, KERNEL_BYTES);
+}
+
+#ifdef __SSE2__
+/*
+ * c | 0x20 folds upper case onto lower case. Adding 128 - 'a' then moves
+ * 'a'..'z' to the bottom of the signed byte range, so one signed compare
+ * classifies all 256 byte values.
+ */
+static uint64_t lower_sse2(char *out, const char *in) {
+  const __m128i case_bit = _mm_set1_epi8(0x20);
+  const __m128i bias = _mm_set1_epi8((char) (128 - 'a'));
+  const __m128i limit = _mm_set1_epi8((char) (-128 + 26));
+  uint64_t mask = 0;
+  for (int k = 0; k < KERNEL_BYTES; k += 16) {
+    __m128i v = _mm_loadu_si128((const __m128i *) (in + k));
+    __m128i lower = _mm_or_si128(v, case_bit);
+    __m128i alpha = _mm_cmplt_epi8(_mm_add_epi8(lower, bias), limit);
+    _mm_storeu_si128((__m128i *) (out + k), _mm_and_si128(lower, alpha));
+    mask |= (uint64_t) (uint16_t) _mm_movemask_epi8(alpha) << k;
+  }
+  return mask;
+}
+
+__attribute__((target("avx2")))
+static uint64_t lower_avx2(char *out, const char *in) {
+  const __m256i case_bit = _mm256_set1_epi8(0x20);
+  const __m256i bias = _mm256_set1_epi8((char) (128 - 'a'));
+  const __m256i limit = _mm256_set1_epi8((char) (-128 + 26));
+  uint64_t mask = 0;
+  for (int k = 0; k < KERNEL_BYTES; k += 32) {
+    __m256i v = _mm256_loadu_si256((const __m256i *) (in + k));
+    __m256i lower = _mm256_or_si256(v, case_bit);
+    __m256i alpha = _mm256_cmpgt_epi8(limit, _mm256_add_epi8(lower, bias));
+    _mm256_storeu_si256((__m256i *) (out + k), _mm256_and_si256(lower, alpha));
+    mask |= (uint64_t) (uint32_t) _mm256_movemask_epi8(alpha) << k;
+  }
+  return mask;
+}
+#endif /* __SSE2__ */
+
+void scan_set_impl(enum scan_impl impl) {
+  forced_impl = impl;
+}
+
+static kernel_fn *pick_kernel(void) {
+  enum scan_impl impl = forced_impl;
+  if (impl == SCAN_AUTO) {
+    const char *env = getenv("WORD_SCAN");
+    if (env == NULL) {
+      impl = SCAN_AVX2;
+    } else if (strcmp(env, "scalar") == 0) {
+      impl = SCAN_SCALAR;
+    } else if (strcmp(env, "sse2") == 0) {
+      impl = SCAN_SSE2;
+    } else {
+      impl = SCAN_AVX2;
+    }
+  }
+#ifdef __SSE2__
+  if (impl == SCAN_AVX2 && __builtin_cpu_supports("avx2")) {
+    return lower_avx2;
+  }
+  if (impl != SCAN_SCALAR) {
+    return lower_sse2;
+  }
+#endif
+  return lower_scalar;
+}
+
+/* Scanner state carried across masks and windows. */
+struct scan {
+  char *buf;          /* Lowercased scratch copy of the input. */
+  size_t cap;         /* Size of buf. */
+  size_t start;       /* Start of the current word in buf, if in_word. */
+  bool in_word;
+  word_fn *fn;
+  void *aux;
+  size_t words;
+};
+
+static void emit(struct scan *s, size_t end) {
+  s->fn(s->buf + s->start, end - s->start, s->aux);
+  s->words++;
+  s->in_word = false;
+}
+
+/*
+ * Handles the NBITS-byte block of buf starting at BASE whose letter bitmask is
+ * ALPHA, emitting every word that ends inside it.
+ */
+static void walk_mask(struct scan *s, uint64_t alpha, size_t base,
+                      int nbits) {
+  uint64_t live = nbits == 64 ? ~0ull : (1ull << nbits) - 1;
+  for (;;) {
+    if (s->in_word) {
+      uint64_t sep = ~alpha & live;
+      if (sep == 0) {
+        return;
+      }
+      int e = __builtin_ctzll(sep);
+      emit(s, base + e);
+      live &= ~((2ull << e) - 1);
+    } else {
+      uint64_t letters = alpha & live;
+      if (letters == 0) {
+        return;
+      }
+      int b = __builtin_ctzll(letters);
+      s->start = base + b;
+      s->in_word = true;
+      live &= ~((1ull << b) - 1);
+    }
+  }
+}
+
+size_t scan_words(const char *data, size_t len, word_fn *fn, void *aux) {
+  kernel_fn *kernel = pick_kernel();
+  struct scan s = { NULL, SCAN_WINDOW, 0, false, fn, aux, 0 };
+  size_t carry = 0;
+  size_t pos = 0;
+
+  if ((s.buf = malloc(s.cap)) == NULL) {
+    perror("malloc");
+    return 0;
+  }
+
+  while (pos < len) {
+    /* A word longer than a window needs more room; keep 1 byte for '\0'. */
+    if (s.cap - carry - 1 < KERNEL_BYTES) {
+      char *buf = realloc(s.buf, s.cap * 2);
+      if (buf == NULL) {
+        perror("realloc");
+        break;
+      }
+      s.buf = buf;
+      s.cap *= 2;
+    }
+    size_t n = s.cap - carry - 1;
+    if (n > len - pos) {
+      n = len - pos;
+    }
+
+    char *out = s.buf + carry;
+    const char *in = data + pos;
+    size_t i = 0;
+    for (; i + KERNEL_BYTES <= n; i += KERNEL_BYTES) {
+      walk_mask(&s, kernel(out + i, in + i), carry + i, KERNEL_BYTES);
+    }
+    if (i < n) {
+      walk_mask(&s, lower_scalar_n(out + i, in + i, n - i), carry + i, n - i);
+    }
+    pos += n;
+
+    size_t filled = carry + n;
+    if (!s.in_word) {
+      carry = 0;
+    } else if (pos == len) {
+      s.buf[filled] = '\0';
+      emit(&s, filled);
+    } else {
+      carry = filled - s.start;
+      memmove(s.buf, s.buf + s.start, carry);
+      s.start = 0;
+    }
+  }
+
+  free(s.buf);
+  return s.words;
+}
@@ -28,9 +28,17 @@
 #include <ctype.h>
 #include <stdlib.h>
 #include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "word_count.h"
 #include "word_helpers.h"
+
+/* Smallest byte range handed to a worker in chunked mode. */
+#define MIN_CHUNK_SIZE (256 * 1024)
+
 typedef struct threadargv{
   word_count_list_t * wc;
   char * file;
@@ -50,15 +58,224 @@ void * countthread(void * arg) {
   pthread_exit(NULL);
 }
 
+/* A byte range of a mapped input file, split on a word boundary. */
+typedef struct chunk {
+  char *start;
+  size_t len;
+} chunk_t;
+
+/* Work shared by the workers of chunked mode. */
+typedef struct chunk_queue {
+  chunk_t *chunks;
+  size_t nchunks;
+  size_t next;
+} chunk_queue_t;
+
+typedef struct chunkargs {
+  chunk_queue_t *queue;
+  word_count_list_t *wc;
+} chunkargs_t;
+
+typedef struct mergeargs {
+  word_count_list_t *dst;
+  word_count_list_t *src;
+} mergeargs_t;
+
+/*
+ * Appends the chunks of the mapped file DATA[0..LEN) to CHUNKS. Each chunk
+ * ends just after a non-alpha byte so no word straddles two chunks.
+ */
+static size_t split_file(char *data, size_t len, size_t chunk_size,
+                         chunk_t **chunks, size_t *nchunks, size_t *cap) {
+  size_t added = 0;
+  size_t pos = 0;
+  while (pos < len) {
+    size_t end = pos + chunk_size < len ? pos + chunk_size : len;
+    while (end < len && isalpha((unsigned char) data[end - 1])) {
+      end++;
+    }
+    if (*nchunks == *cap) {
+      *cap = *cap ? *cap * 2 : 64;
+      *chunks = realloc(*chunks, *cap * sizeof **chunks);
+      if (*chunks == NULL) {
+        perror("realloc");
+        exit(1);
+      }
+    }
+    (*chunks)[(*nchunks)++] = (chunk_t) { data + pos, end - pos };
+    added++;
+    pos = end;
+  }
+  return added;
+}
+
+/*
+ * chunkthread - count chunks from the shared queue into a private list
+ */
+void * chunkthread(void * arg) {
+  chunkargs_t * ca = (chunkargs_t *) arg;
+  chunk_queue_t * q = ca->queue;
+  size_t i;
+  while ((i = __sync_fetch_and_add(&q->next, 1)) < q->nchunks) {
+    count_words_buf(ca->wc, q->chunks[i].start, q->chunks[i].len);
+  }
+  return NULL;
+}
+
+/*
+ * mergethread - fold one private list into another
+ */
+void * mergethread(void * arg) {
+  mergeargs_t * ma = (mergeargs_t *) arg;
+  if (!merge_words(ma->dst, ma->src)) {
+    exit(1);
+  }
+  return NULL;
+}
+
+/*
+ * xcalloc - allocate N zeroed objects of SIZE bytes, exiting on failure
+ */
+static void *xcalloc(size_t n, size_t size) {
+  void *p = calloc(n, size);
+  if (p == NULL) {
+    perror("calloc");
+    exit(1);
+  }
+  return p;
+}
+
+/*
+ * count_chunked - map-reduce counting of FILES into word_counts.
+ *
+ * Every file is mapped and cut into byte ranges, and NTHREADS workers pull
+ * ranges from a shared queue into their own lists, so neither the file count
+ * nor their sizes limit parallelism and no lock is contended while counting.
+ * The private lists are then combined by a parallel tree reduction.
+ */
+static void count_chunked(word_count_list_t *word_counts, int nthreads,
+                          char **files, int nfiles) {
+  chunk_queue_t queue = { NULL, 0, 0 };
+  size_t cap = 0;
+  size_t total = 0;
+  /* Both counts come from the command line, so keep these off the stack. */
+  char **maps = xcalloc(nfiles, sizeof *maps);
+  size_t *lens = xcalloc(nfiles, sizeof *lens);
+
+  for (int i = 0; i < nfiles; i++) {
+    int fd = open(files[i], O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) < 0) {
+      perror(files[i]);
+      exit(1);
+    }
+    lens[i] = st.st_size;
+    maps[i] = NULL;
+    if (lens[i] > 0) {
+      maps[i] = mmap(NULL, lens[i], PROT_READ, MAP_PRIVATE, fd, 0);
+      if (maps[i] == MAP_FAILED) {
+        perror("mmap");
+        exit(1);
+      }
+    }
+    close(fd);
+    total += lens[i];
+  }
+
+  /* Aim for several chunks per worker so uneven chunks even out. */
+  size_t chunk_size = total / ((size_t) nthreads * 4) + 1;
+  if (chunk_size < MIN_CHUNK_SIZE) {
+    chunk_size = MIN_CHUNK_SIZE;
+  }
+  for (int i = 0; i < nfiles; i++) {
+    split_file(maps[i], lens[i], chunk_size, &queue.chunks, &queue.nchunks,
+               &cap);
+  }
+
+  word_count_list_t *lists = xcalloc(nthreads, sizeof *lists);
+  chunkargs_t *cargs = xcalloc(nthreads, sizeof *cargs);
+  pthread_t *p = xcalloc(nthreads, sizeof *p);
+  for (int t = 0; t < nthreads; t++) {
+    init_words(&lists[t]);
+    cargs[t] = (chunkargs_t) { &queue, &lists[t] };
+    if (pthread_create(&p[t], NULL, chunkthread, &cargs[t])) {
+      printf("Thread %d wasn't created", t);
+      exit(1);
+    }
+  }
+  for (int t = 0; t < nthreads; t++) {
+    pthread_join(p[t], NULL);
+  }
+
+  /* Reduce pairwise: after the round with stride s, lists[i] for i a
+     multiple of 2s holds the counts of lists[i .. i + 2s). */
+  mergeargs_t *margs = xcalloc(nthreads, sizeof *margs);
+  for (int stride = 1; stride < nthreads; stride *= 2) {
+    int n = 0;
+    for (int i = 0; i + stride < nthreads; i += 2 * stride) {
+      margs[n] = (mergeargs_t) { &lists[i], &lists[i + stride] };
+      if (pthread_create(&p[n], NULL, mergethread, &margs[n])) {
+        printf("Thread %d wasn't created", n);
+        exit(1);
+      }
+      n++;
+    }
+    for (int t = 0; t < n; t++) {
+      pthread_join(p[t], NULL);
+    }
+  }
+  if (!merge_words(word_counts, &lists[0])) {
+    exit(1);
+  }
+
+  free(queue.chunks);
+  free(margs);
+  free(p);
+  free(cargs);
+  free(lists);
+  for (int i = 0; i < nfiles; i++) {
+    if (maps[i] != NULL) {
+      munmap(maps[i], lens[i]);
+    }
+  }
+  free(lens);
+  free(maps);
+}
+
 /*
- * main - handle command line, spawning one thread per file.
+ * main - handle command line, spawning one thread per file, or with -j N,
+ * N threads over byte-range chunks of all the files. -k N prints only the N
+ * most frequent words, and -B writes the full listing in bulk.
  */
 int main(int argc, char *argv[]) {
   /* Create the empty data structure. */
   word_count_list_t word_counts;
   init_words(&word_counts);
 
-  if (argc <= 1) {
+  int nthreads = 0;
+  size_t top = 0;
+  bool bulk = false;
+  int opt;
+  while ((opt = getopt(argc, argv, "j:k:B")) != -1) {
+    if (opt == 'j' && (nthreads = atoi(optarg)) > 0) {
+      continue;
+    } else if (opt == 'k' && atol(optarg) > 0) {
+      top = atol(optarg);
+      continue;
+    } else if (opt == 'B') {
+      bulk = true;
+      continue;
+    }
+    fprintf(stderr, "Usage: %s [-j nthreads] [-k top] [-B] [file...]\n",
+            argv[0]);
+    return 1;
+  }
+  argc -= optind - 1;
+  argv += optind - 1;
+
+  if (nthreads > 0 && argc > 1) {
+    count_chunked(&word_counts, nthreads, argv + 1, argc - 1);
+  } else if (argc <= 1) {
     /* Process stdin in a single thread. */
     count_words(&word_counts, stdin);
   } else {
@@ -83,7 +300,15 @@ int main(int argc, char *argv[]) {
   }
 
   /* Output final result of all threads' work. */
-  wordcount_sort(&word_counts, less_count);
-  fprint_words(&word_counts, stdout);
+  if (top > 0) {
+    fprint_top_words(&word_counts, stdout, top, less_count);
+  } else {
+    wordcount_sort(&word_counts, less_count);
+    if (bulk) {
+      fprint_words_bulk(&word_counts, stdout);
+    } else {
+      fprint_words(&word_counts, stdout);
+    }
+  }
   return 0;
 }
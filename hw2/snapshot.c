@@ -0,0 +1,387 @@
+/*
+ * Implementation of the snapshot interface.
+ */
+
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "snapshot.h"
+#include "word_helpers.h"
+
+#define ALIGN8(x) (((x) + 7) & ~(uint64_t) 7)
+
+/* Points snap's fields into the image base[0..size), checking its bounds. */
+static bool parse(snapshot_t *snap, void *base, size_t size, const char *name) {
+  const struct snapshot_header *h = base;
+  if (size < sizeof *h || memcmp(h->magic, SNAPSHOT_MAGIC, 8) != 0) {
+    fprintf(stderr, "%s: not a word count snapshot\n", name);
+    return false;
+  }
+  if (h->nwords > size / sizeof(uint64_t) ||
+      h->strtab_off > size || h->strtab_size > size ||
+      h->offsets_off > size || h->counts_off > size ||
+      h->files_off > size || h->files_size > size ||
+      h->strtab_off + h->strtab_size > size ||
+      h->offsets_off + h->nwords * sizeof(uint64_t) > size ||
+      h->counts_off + h->nwords * sizeof(uint64_t) > size ||
+      h->files_off + h->files_size > size ||
+      (h->strtab_size > 0 && ((const char *) base)[h->strtab_off +
+                                                   h->strtab_size - 1]) ||
+      (h->files_size > 0 && ((const char *) base)[h->files_off +
+                                                  h->files_size - 1])) {
+    fprintf(stderr, "%s: snapshot is truncated or corrupt\n", name);
+    return false;
+  }
+  /* Every word must start inside the string table, whose last byte was
+     checked to be a NUL above, so it ends inside it too. */
+  const uint64_t *offsets = (const uint64_t *) ((const char *) base +
+                                                h->offsets_off);
+  for (uint64_t i = 0; i < h->nwords; i++) {
+    if (offsets[i] >= h->strtab_size) {
+      fprintf(stderr, "%s: snapshot is truncated or corrupt\n", name);
+      return false;
+    }
+  }
+  snap->nwords = h->nwords;
+  snap->total = h->total;
+  snap->strtab = (const char *) base + h->strtab_off;
+  snap->offsets = offsets;
+  snap->counts = (const uint64_t *) ((const char *) base + h->counts_off);
+  snap->files = (const char *) base + h->files_off;
+  snap->files_size = h->files_size;
+  snap->nfiles = h->nfiles;
+  snap->base = base;
+  snap->size = size;
+  return true;
+}
+
+bool snapshot_open(snapshot_t *snap, const char *path) {
+  struct stat st;
+  int fd = open(path, O_RDONLY);
+  if (fd < 0 || fstat(fd, &st) < 0) {
+    perror(path);
+    if (fd >= 0) {
+      close(fd);
+    }
+    return false;
+  }
+  void *base = mmap(NULL, st.st_size ? st.st_size : 1, PROT_READ, MAP_PRIVATE,
+                    fd, 0);
+  close(fd);
+  if (base == MAP_FAILED) {
+    perror("mmap");
+    return false;
+  }
+  snap->mapped = true;
+  if (!parse(snap, base, st.st_size, path)) {
+    munmap(base, st.st_size ? st.st_size : 1);
+    return false;
+  }
+  return true;
+}
+
+/* Sizes an in-memory image while entries are appended to it. */
+struct builder {
+  char *strtab;
+  uint64_t *offsets;
+  uint64_t *counts;
+  uint64_t n;
+  uint64_t strtab_size;
+  uint64_t total;
+};
+
+static void build_entry(word_count_t *wc, void *aux) {
+  struct builder *b = aux;
+  size_t len = strlen(wc->word) + 1;
+  memcpy(b->strtab + b->strtab_size, wc->word, len);
+  b->offsets[b->n] = b->strtab_size;
+  b->counts[b->n] = wc->count;
+  b->strtab_size += len;
+  b->total += wc->count;
+  b->n++;
+}
+
+static void measure_entry(word_count_t *wc, void *aux) {
+  *(uint64_t *) aux += strlen(wc->word) + 1;
+}
+
+bool snapshot_from_words(snapshot_t *snap, word_count_list_t *wclist,
+                         char **files, size_t nfiles) {
+  uint64_t nwords = len_words(wclist);
+  uint64_t strtab_size = 0;
+  uint64_t files_size = 0;
+  foreach_word(wclist, measure_entry, &strtab_size);
+  for (size_t i = 0; i < nfiles; i++) {
+    files_size += strlen(files[i]) + 1;
+  }
+
+  struct snapshot_header h;
+  memcpy(h.magic, SNAPSHOT_MAGIC, 8);
+  h.nwords = nwords;
+  h.strtab_off = ALIGN8(sizeof h);
+  h.strtab_size = strtab_size;
+  h.offsets_off = ALIGN8(h.strtab_off + strtab_size);
+  h.counts_off = h.offsets_off + nwords * sizeof(uint64_t);
+  h.files_off = h.counts_off + nwords * sizeof(uint64_t);
+  h.files_size = files_size;
+  h.nfiles = nfiles;
+
+  size_t size = h.files_off + files_size;
+  char *base = calloc(1, size);
+  if (base == NULL) {
+    perror("calloc");
+    return false;
+  }
+
+  wordcount_sort(wclist, less_word);
+  struct builder b = {
+    base + h.strtab_off,
+    (uint64_t *) (base + h.offsets_off),
+    (uint64_t *) (base + h.counts_off),
+    0, 0, 0
+  };
+  foreach_word(wclist, build_entry, &b);
+  h.total = b.total;
+
+  char *f = base + h.files_off;
+  for (size_t i = 0; i < nfiles; i++) {
+    size_t len = strlen(files[i]) + 1;
+    memcpy(f, files[i], len);
+    f += len;
+  }
+  memcpy(base, &h, sizeof h);
+
+  snap->mapped = false;
+  return parse(snap, base, size, "snapshot");
+}
+
+void snapshot_close(snapshot_t *snap) {
+  if (snap->mapped) {
+    munmap(snap->base, snap->size ? snap->size : 1);
+  } else {
+    free(snap->base);
+  }
+  snap->base = NULL;
+}
+
+bool snapshot_has_file(const snapshot_t *snap, const char *path) {
+  const char *f = snap->files;
+  const char *end = snap->files + snap->files_size;
+  while (f < end) {
+    if (strcmp(f, path) == 0) {
+      return true;
+    }
+    f += strlen(f) + 1;
+  }
+  return false;
+}
+
+/*
+ * Returns true if no file is recorded by more than one of snaps[0..n), since
+ * merging such snapshots would count that file twice.
+ */
+static bool files_disjoint(const snapshot_t *snaps, size_t n) {
+  for (size_t i = 1; i < n; i++) {
+    const char *f = snaps[i].files;
+    const char *end = snaps[i].files + snaps[i].files_size;
+    for (; f < end; f += strlen(f) + 1) {
+      for (size_t j = 0; j < i; j++) {
+        if (snapshot_has_file(&snaps[j], f)) {
+          fprintf(stderr, "%s: counted by more than one snapshot\n", f);
+          return false;
+        }
+      }
+    }
+  }
+  return true;
+}
+
+/* Position of one input in the k-way merge. */
+struct cursor {
+  const snapshot_t *snap;
+  uint64_t pos;
+};
+
+static const char *cursor_word(const struct cursor *c) {
+  return snapshot_word(c->snap, c->pos);
+}
+
+/* Restores the min-heap order of heap[0..n) below index i. */
+static void sift_down(struct cursor *heap, size_t n, size_t i) {
+  for (;;) {
+    size_t min = i;
+    size_t l = 2 * i + 1;
+    size_t r = l + 1;
+    if (l < n && strcmp(cursor_word(&heap[l]), cursor_word(&heap[min])) < 0) {
+      min = l;
+    }
+    if (r < n && strcmp(cursor_word(&heap[r]), cursor_word(&heap[min])) < 0) {
+      min = r;
+    }
+    if (min == i) {
+      return;
+    }
+    struct cursor tmp = heap[i];
+    heap[i] = heap[min];
+    heap[min] = tmp;
+    i = min;
+  }
+}
+
+/* Doubles the capacity of the output's offsets and counts arrays. */
+static bool grow(uint64_t **offsets, uint64_t **counts, uint64_t *cap) {
+  uint64_t new_cap = *cap ? *cap * 2 : 1024;
+  uint64_t *o = realloc(*offsets, new_cap * sizeof *o);
+  if (o != NULL) {
+    *offsets = o;
+  }
+  uint64_t *c = realloc(*counts, new_cap * sizeof *c);
+  if (c != NULL) {
+    *counts = c;
+  }
+  if (o == NULL || c == NULL) {
+    perror("realloc");
+    return false;
+  }
+  *cap = new_cap;
+  return true;
+}
+
+static bool pad_to(FILE *out, uint64_t *pos, uint64_t target) {
+  static const char zeros[8];
+  if (target > *pos && fwrite(zeros, 1, target - *pos, out) != target - *pos) {
+    return false;
+  }
+  *pos = target;
+  return true;
+}
+
+/*
+ * The output is written beside PATH and renamed over it only once complete,
+ * because PATH may be one of the inputs and still be mapped.
+ */
+bool snapshot_merge(const char *path, snapshot_t *snaps, size_t n) {
+  struct snapshot_header h;
+  memset(&h, 0, sizeof h);
+  memcpy(h.magic, SNAPSHOT_MAGIC, 8);
+
+  struct cursor *heap = malloc((n ? n : 1) * sizeof *heap);
+  uint64_t *offsets = NULL;
+  uint64_t *counts = NULL;
+  uint64_t cap = 0;
+  bool ok = false;
+  FILE *out = NULL;
+  char tmp[PATH_MAX];
+
+  if (heap == NULL) {
+    perror("malloc");
+    return false;
+  }
+  if (!files_disjoint(snaps, n)) {
+    goto done;
+  }
+  if (snprintf(tmp, sizeof tmp, "%s.tmp", path) >= (int) sizeof tmp) {
+    fprintf(stderr, "%s: path too long\n", path);
+    goto done;
+  }
+  if ((out = fopen(tmp, "wb")) == NULL) {
+    perror(tmp);
+    goto done;
+  }
+
+  /* Reserve room for the header, rewritten once the sizes are known. */
+  uint64_t pos = sizeof h;
+  if (fwrite(&h, sizeof h, 1, out) != 1 || !pad_to(out, &pos, ALIGN8(pos))) {
+    goto write_error;
+  }
+  h.strtab_off = pos;
+
+  size_t live = 0;
+  for (size_t i = 0; i < n; i++) {
+    if (snaps[i].nwords > 0) {
+      heap[live++] = (struct cursor) { &snaps[i], 0 };
+    }
+  }
+  for (size_t i = live / 2; i-- > 0;) {
+    sift_down(heap, live, i);
+  }
+
+  while (live > 0) {
+    const char *word = cursor_word(&heap[0]);
+    uint64_t count = 0;
+
+    /* Drain every input whose current word equals the smallest one. */
+    while (live > 0 && strcmp(cursor_word(&heap[0]), word) == 0) {
+      count += heap[0].snap->counts[heap[0].pos];
+      if (++heap[0].pos == heap[0].snap->nwords) {
+        heap[0] = heap[--live];
+      }
+      sift_down(heap, live, 0);
+    }
+
+    size_t len = strlen(word) + 1;
+    if (h.nwords == cap && !grow(&offsets, &counts, &cap)) {
+      goto done;
+    }
+    offsets[h.nwords] = pos - h.strtab_off;
+    counts[h.nwords++] = count;
+    h.total += count;
+    if (fwrite(word, 1, len, out) != len) {
+      goto write_error;
+    }
+    pos += len;
+  }
+  h.strtab_size = pos - h.strtab_off;
+
+  if (!pad_to(out, &pos, ALIGN8(pos))) {
+    goto write_error;
+  }
+  h.offsets_off = pos;
+  h.counts_off = h.offsets_off + h.nwords * sizeof(uint64_t);
+  h.files_off = h.counts_off + h.nwords * sizeof(uint64_t);
+  if (fwrite(offsets, sizeof(uint64_t), h.nwords, out) != h.nwords ||
+      fwrite(counts, sizeof(uint64_t), h.nwords, out) != h.nwords) {
+    goto write_error;
+  }
+
+  /* The output was counted from every input of every snapshot. */
+  for (size_t i = 0; i < n; i++) {
+    if (fwrite(snaps[i].files, 1, snaps[i].files_size, out) !=
+        snaps[i].files_size) {
+      goto write_error;
+    }
+    h.files_size += snaps[i].files_size;
+    h.nfiles += snaps[i].nfiles;
+  }
+
+  if (fseek(out, 0, SEEK_SET) != 0 || fwrite(&h, sizeof h, 1, out) != 1) {
+    goto write_error;
+  }
+  ok = true;
+  goto done;
+
+write_error:
+  perror(tmp);
+done:
+  if (out != NULL && fclose(out) != 0 && ok) {
+    perror(tmp);
+    ok = false;
+  }
+  if (ok && rename(tmp, path) != 0) {
+    perror(path);
+    ok = false;
+  }
+  if (out != NULL && !ok) {
+    unlink(tmp);
+  }
+  free(heap);
+  free(offsets);
+  free(counts);
+  return ok;
+}
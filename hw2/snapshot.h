@@ -0,0 +1,82 @@
+/*
+ * The snapshot interface stores word counts in a compact binary file that can
+ * be mapped and used in place, and merges any number of snapshots in one
+ * streaming pass.
+ *
+ * File layout (native byte order, every section 8-byte aligned):
+ *
+ *   struct snapshot_header
+ *   char     strtab[]           words in strcmp order, each '\0'-terminated
+ *   uint64_t offsets[nwords]    offset of each word in strtab
+ *   uint64_t counts[nwords]     count of each word
+ *   char     files[]            '\0'-terminated paths of the counted inputs
+ */
+
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "word_count.h"
+
+#define SNAPSHOT_MAGIC "WCSNAP01"
+
+struct snapshot_header {
+  char magic[8];
+  uint64_t nwords;
+  uint64_t total;        /* Sum of all counts. */
+  uint64_t strtab_off;
+  uint64_t strtab_size;
+  uint64_t offsets_off;
+  uint64_t counts_off;
+  uint64_t files_off;
+  uint64_t files_size;
+  uint64_t nfiles;
+};
+
+/* A snapshot, either mapped from a file or built in memory. */
+typedef struct snapshot {
+  uint64_t nwords;
+  uint64_t total;
+  const char *strtab;
+  const uint64_t *offsets;
+  const uint64_t *counts;
+  const char *files;
+  uint64_t files_size;
+  uint64_t nfiles;
+  void *base;            /* Mapping or allocation backing the above. */
+  size_t size;
+  bool mapped;
+} snapshot_t;
+
+/* Maps the snapshot at path. Returns false and prints why on failure. */
+bool snapshot_open(snapshot_t *snap, const char *path);
+
+/*
+ * Builds an in-memory snapshot of wclist, which is sorted by word as a side
+ * effect. files[0..nfiles) are recorded as the inputs it was counted from.
+ */
+bool snapshot_from_words(snapshot_t *snap, word_count_list_t *wclist,
+                         char **files, size_t nfiles);
+
+void snapshot_close(snapshot_t *snap);
+
+/* Returns word i of a snapshot. */
+static inline const char *snapshot_word(const snapshot_t *snap, uint64_t i) {
+  return snap->strtab + snap->offsets[i];
+}
+
+/* Returns true if path is one of the inputs recorded in snap. */
+bool snapshot_has_file(const snapshot_t *snap, const char *path);
+
+/*
+ * Writes the union of snaps[0..n) to path with a k-way merge over their
+ * sorted string tables, summing the counts of equal words. Only the output's
+ * offsets and counts are held in memory; words are streamed to the file.
+ * Fails if two of the snaps record the same input file.
+ */
+bool snapshot_merge(const char *path, snapshot_t *snaps, size_t n);
+
+#endif /* SNAPSHOT_H */
@@ -0,0 +1,192 @@
+/*
+ * Word count snapshots, for recounting a growing corpus incrementally.
+ *
+ *   wcsnap count OUT FILE...      count FILEs into a new snapshot OUT
+ *   wcsnap update SNAP FILE...    count only the FILEs SNAP has not seen yet
+ *                                 and merge them into SNAP
+ *   wcsnap merge OUT SNAP...      merge any number of snapshots into OUT
+ *   wcsnap print [-k N] SNAP      print counts like words, optionally only
+ *                                 the N most frequent
+ */
+
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "snapshot.h"
+#include "word_count.h"
+#include "word_helpers.h"
+
+static void usage(const char *prog) {
+  fprintf(stderr,
+          "Usage: %s count OUT FILE...\n"
+          "       %s update SNAP FILE...\n"
+          "       %s merge OUT SNAP...\n"
+          "       %s print [-k top] SNAP\n",
+          prog, prog, prog, prog);
+  exit(1);
+}
+
+/*
+ * Counts the files in paths[0..n) that old (if not NULL) has not recorded
+ * into a new in-memory snapshot. Paths are canonicalized in place so that a
+ * file is recognized however it is named.
+ */
+static bool count_new_files(snapshot_t *snap, const snapshot_t *old,
+                            char **paths, int n) {
+  word_count_list_t word_counts;
+  char **counted = malloc((n ? n : 1) * sizeof *counted);
+  size_t ncounted = 0;
+  bool ok;
+
+  init_words(&word_counts);
+  for (int i = 0; i < n; i++) {
+    char *path = realpath(paths[i], NULL);
+    if (path == NULL) {
+      perror(paths[i]);
+      exit(1);
+    }
+    if ((old != NULL && snapshot_has_file(old, path))) {
+      free(path);
+      continue;
+    }
+    FILE *infile = fopen(path, "r");
+    if (infile == NULL) {
+      perror(path);
+      exit(1);
+    }
+    count_words(&word_counts, infile);
+    fclose(infile);
+    counted[ncounted++] = path;
+  }
+
+  fprintf(stderr, "counted %zu new file(s)\n", ncounted);
+  ok = snapshot_from_words(snap, &word_counts, counted, ncounted);
+  for (size_t i = 0; i < ncounted; i++) {
+    free(counted[i]);
+  }
+  free(counted);
+  return ok;
+}
+
+static int cmd_count(int argc, char *argv[]) {
+  snapshot_t snap;
+  if (!count_new_files(&snap, NULL, argv + 1, argc - 1) ||
+      !snapshot_merge(argv[0], &snap, 1)) {
+    return 1;
+  }
+  snapshot_close(&snap);
+  return 0;
+}
+
+static int cmd_update(int argc, char *argv[]) {
+  snapshot_t snaps[2];
+  bool ok;
+
+  if (!snapshot_open(&snaps[0], argv[0])) {
+    return 1;
+  }
+  if (!count_new_files(&snaps[1], &snaps[0], argv + 1, argc - 1)) {
+    return 1;
+  }
+
+  /* snapshot_merge() swaps the new snapshot in only once complete. */
+  ok = snapshot_merge(argv[0], snaps, 2);
+  snapshot_close(&snaps[0]);
+  snapshot_close(&snaps[1]);
+  return ok ? 0 : 1;
+}
+
+static int cmd_merge(int argc, char *argv[]) {
+  int n = argc - 1;
+  snapshot_t *snaps = malloc((n ? n : 1) * sizeof *snaps);
+  int opened = 0;
+  bool ok;
+
+  if (snaps == NULL) {
+    perror("malloc");
+    return 1;
+  }
+  while (opened < n && snapshot_open(&snaps[opened], argv[opened + 1])) {
+    opened++;
+  }
+  ok = opened == n && snapshot_merge(argv[0], snaps, n);
+  for (int i = 0; i < opened; i++) {
+    snapshot_close(&snaps[i]);
+  }
+  free(snaps);
+  return ok ? 0 : 1;
+}
+
+static int cmd_print(int argc, char *argv[]) {
+  word_count_list_t word_counts;
+  snapshot_t snap;
+  size_t top = 0;
+  int opt;
+
+  optind = 0;
+  while ((opt = getopt(argc, argv, "+k:")) != -1) {
+    if (opt != 'k' || atol(optarg) <= 0) {
+      return -1;
+    }
+    top = atol(optarg);
+  }
+  if (optind != argc - 1) {
+    return -1;
+  }
+  if (!snapshot_open(&snap, argv[optind])) {
+    return 1;
+  }
+
+  init_words(&word_counts);
+  for (uint64_t i = 0; i < snap.nwords; i++) {
+    const char *word = snapshot_word(&snap, i);
+    /* Counts are printed through the int count field of the word list. */
+    if (snap.counts[i] > INT_MAX) {
+      fprintf(stderr, "%s: count %llu of \"%s\" is too large to print\n",
+              argv[optind], (unsigned long long) snap.counts[i], word);
+      snapshot_close(&snap);
+      return 1;
+    }
+    word_count_t *wc = add_word_len(&word_counts, word, strlen(word));
+    if (wc == NULL) {
+      return 1;
+    }
+    wc->count = (int) snap.counts[i];
+  }
+  snapshot_close(&snap);
+
+  if (top > 0) {
+    fprint_top_words(&word_counts, stdout, top, less_count);
+  } else {
+    wordcount_sort(&word_counts, less_count);
+    fprint_words_bulk(&word_counts, stdout);
+  }
+  return 0;
+}
+
+int main(int argc, char *argv[]) {
+  if (argc < 3) {
+    usage(argv[0]);
+  }
+
+  const char *cmd = argv[1];
+  int status;
+  if (strcmp(cmd, "count") == 0) {
+    status = cmd_count(argc - 2, argv + 2);
+  } else if (strcmp(cmd, "update") == 0) {
+    status = cmd_update(argc - 2, argv + 2);
+  } else if (strcmp(cmd, "merge") == 0) {
+    status = cmd_merge(argc - 2, argv + 2);
+  } else if (strcmp(cmd, "print") == 0) {
+    status = cmd_print(argc - 1, argv + 1);
+  } else {
+    status = -1;
+  }
+  if (status < 0) {
+    usage(argv[0]);
+  }
+  return status;
+}
@@ -0,0 +1,401 @@
+/*
+ * Implementation of the word_count interface using an open-addressing hash
+ * table. Entries and the words they hold are carved out of an arena, so
+ * inserting a new word costs one copy and no per-word malloc. When PTHREADS
+ * is #define'd, every operation is protected by the list's lock.
+ */
+
+/*
+ * Copyright © 2019 University of California, Berkeley
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef HASH_TABLE
+#error "HASH_TABLE must be #define'd when compiling word_count_h.c"
+#endif
+
+#include "word_count.h"
+
+#ifdef PTHREADS
+#define LOCK(wclist) pthread_mutex_lock(&(wclist)->lock)
+#define UNLOCK(wclist) pthread_mutex_unlock(&(wclist)->lock)
+#else
+#define LOCK(wclist) ((void) 0)
+#define UNLOCK(wclist) ((void) 0)
+#endif
+
+#define INITIAL_CAPACITY 1024
+#define ARENA_BLOCK_SIZE (64 * 1024)
+
+/* A chain of blocks handed out by bumping a pointer. */
+struct word_count_arena {
+  struct word_count_arena *next;
+  size_t used;
+  size_t size;
+  char data[];
+};
+
+/* Rounds an arena allocation up so that every entry stays aligned. */
+#define ARENA_ROUND(size) (((size) + 7) & ~(size_t) 7)
+
+/* Makes sure the current block has SIZE bytes free, or starts a new one. */
+static bool arena_reserve(struct word_count_arena **arena, size_t size) {
+  struct word_count_arena *block = *arena;
+  if (block == NULL || block->size - block->used < size) {
+    size_t block_size = size > ARENA_BLOCK_SIZE ? size : ARENA_BLOCK_SIZE;
+    if ((block = malloc(sizeof *block + block_size)) == NULL) {
+      perror("malloc");
+      return false;
+    }
+    block->next = *arena;
+    block->used = 0;
+    block->size = block_size;
+    *arena = block;
+  }
+  return true;
+}
+
+static void *arena_alloc(struct word_count_arena **arena, size_t size) {
+  size = ARENA_ROUND(size);
+  if (!arena_reserve(arena, size)) {
+    return NULL;
+  }
+  struct word_count_arena *block = *arena;
+  void *p = block->data + block->used;
+  block->used += size;
+  return p;
+}
+
+/* FNV-1a. */
+static uint32_t hash_word(const char *word, size_t len) {
+  uint32_t h = 2166136261u;
+  for (size_t i = 0; i < len; i++) {
+    h = (h ^ (unsigned char) word[i]) * 16777619u;
+  }
+  return h;
+}
+
+/* Returns the slot holding WORD[0..LEN), or the empty slot where it belongs. */
+static struct word_count_slot *lookup(word_count_list_t *wclist,
+                                      const char *word, size_t len,
+                                      uint32_t hash) {
+  size_t mask = wclist->capacity - 1;
+  size_t i = hash & mask;
+  for (;;) {
+    struct word_count_slot *slot = &wclist->slots[i];
+    if (slot->index == 0) {
+      return slot;
+    }
+    if (slot->hash == hash) {
+      const char *entry = wclist->entries[slot->index - 1]->word;
+      if (strncmp(entry, word, len) == 0 && entry[len] == '\0') {
+        return slot;
+      }
+    }
+    i = (i + 1) & mask;
+  }
+}
+
+/*
+ * Stores SLOT in the first empty slot of SLOTS[0..CAPACITY) at or after its
+ * hash, without comparing words.
+ */
+static void place(struct word_count_slot *slots, size_t capacity,
+                  struct word_count_slot slot) {
+  size_t j = slot.hash & (capacity - 1);
+  while (slots[j].index != 0) {
+    j = (j + 1) & (capacity - 1);
+  }
+  slots[j] = slot;
+}
+
+/*
+ * Doubles the table, reinserting entries by their cached hash. A list without
+ * a table yet gets one of INITIAL_CAPACITY slots.
+ */
+static bool grow(word_count_list_t *wclist) {
+  size_t capacity = wclist->capacity ? wclist->capacity * 2 : INITIAL_CAPACITY;
+  struct word_count_slot *slots = calloc(capacity, sizeof *slots);
+  if (slots == NULL) {
+    perror("calloc");
+    return false;
+  }
+  for (size_t i = 0; i < wclist->capacity; i++) {
+    if (wclist->slots[i].index != 0) {
+      place(slots, capacity, wclist->slots[i]);
+    }
+  }
+  free(wclist->slots);
+  wclist->slots = slots;
+  wclist->capacity = capacity;
+  return true;
+}
+
+/*
+ * If the initial allocations fail, the list is left empty without a table, and
+ * the first insert tries to allocate one again.
+ */
+void init_words(word_count_list_t *wclist) {
+  wclist->capacity = INITIAL_CAPACITY;
+  wclist->slots = calloc(wclist->capacity, sizeof *wclist->slots);
+  wclist->entries_cap = INITIAL_CAPACITY / 2;
+  wclist->entries = malloc(wclist->entries_cap * sizeof *wclist->entries);
+  if (wclist->slots == NULL || wclist->entries == NULL) {
+    perror("malloc");
+    free(wclist->slots);
+    free(wclist->entries);
+    wclist->slots = NULL;
+    wclist->capacity = 0;
+    wclist->entries = NULL;
+    wclist->entries_cap = 0;
+  }
+  wclist->size = 0;
+  wclist->arena = NULL;
+#ifdef PTHREADS
+  pthread_mutex_init(&wclist->lock, NULL);
+#endif
+}
+
+size_t len_words(word_count_list_t *wclist) {
+  size_t len;
+  LOCK(wclist);
+  len = wclist->size;
+  UNLOCK(wclist);
+  return len;
+}
+
+word_count_t *find_word(word_count_list_t *wclist, char *word) {
+  struct word_count_slot *slot;
+  word_count_t *wc = NULL;
+  LOCK(wclist);
+  size_t len = strlen(word);
+  if (wclist->capacity > 0) {
+    slot = lookup(wclist, word, len, hash_word(word, len));
+    if (slot->index != 0) {
+      wc = wclist->entries[slot->index - 1];
+    }
+  }
+  UNLOCK(wclist);
+  return wc;
+}
+
+/* Makes room in ENTRIES for at least CAP entries. */
+static bool reserve_entries(word_count_list_t *wclist, size_t cap) {
+  if (cap <= wclist->entries_cap) {
+    return true;
+  }
+  word_count_t **entries = realloc(wclist->entries, cap * sizeof *entries);
+  if (entries == NULL) {
+    perror("realloc");
+    return false;
+  }
+  wclist->entries = entries;
+  wclist->entries_cap = cap;
+  return true;
+}
+
+/*
+ * Adds COUNT to WORD[0..LEN), interning a copy of it in the arena if it is
+ * not present yet. The caller must hold the lock.
+ */
+static word_count_t *insert(word_count_list_t *wclist, const char *word,
+                            size_t len, uint32_t hash, int count) {
+  word_count_t *wc;
+  struct word_count_slot *slot;
+  if (wclist->capacity == 0 && !grow(wclist)) {
+    return NULL;
+  }
+  slot = lookup(wclist, word, len, hash);
+  if (slot->index != 0) {
+    wc = wclist->entries[slot->index - 1];
+    wc->count += count;
+    return wc;
+  }
+
+  /* Keep the load factor at or below 1/2. */
+  if ((wclist->size + 1) * 2 > wclist->capacity) {
+    if (!grow(wclist)) {
+      return NULL;
+    }
+    slot = lookup(wclist, word, len, hash);
+  }
+  if (wclist->size == wclist->entries_cap &&
+      !reserve_entries(wclist, wclist->entries_cap ?
+                                   wclist->entries_cap * 2 :
+                                   INITIAL_CAPACITY / 2)) {
+    return NULL;
+  }
+
+  if ((wc = arena_alloc(&wclist->arena, sizeof *wc + len + 1)) == NULL) {
+    return NULL;
+  }
+  wc->word = memcpy((char *) (wc + 1), word, len);
+  wc->word[len] = '\0';
+  wc->count = count;
+  wc->hash = hash;
+  wclist->entries[wclist->size++] = wc;
+  slot->hash = hash;
+  slot->index = wclist->size;
+  return wc;
+}
+
+word_count_t *add_word_with_count(word_count_list_t *wclist, char *word,
+                                  int count) {
+  /* The word is always copied into the arena, so the caller's copy goes. */
+  size_t len = strlen(word);
+  uint32_t hash = hash_word(word, len);
+  word_count_t *wc;
+  LOCK(wclist);
+  wc = insert(wclist, word, len, hash, count);
+  UNLOCK(wclist);
+  if (wc != NULL) {
+    free(word);
+  }
+  return wc;
+}
+
+word_count_t *add_word(word_count_list_t *wclist, char *word) {
+  return add_word_with_count(wclist, word, 1);
+}
+
+word_count_t *add_word_len(word_count_list_t *wclist, const char *word,
+                           size_t len) {
+  uint32_t hash = hash_word(word, len);
+  word_count_t *wc;
+  LOCK(wclist);
+  wc = insert(wclist, word, len, hash, 1);
+  UNLOCK(wclist);
+  return wc;
+}
+
+/*
+ * Makes room in DST for every entry of SRC as a new word, so that merging SRC
+ * into it cannot fail part way.
+ */
+static bool reserve_merge(word_count_list_t *dst, word_count_list_t *src) {
+  size_t size = dst->size + src->size;
+  size_t bytes = 0;
+  while (size * 2 > dst->capacity) {
+    if (!grow(dst)) {
+      return false;
+    }
+  }
+  for (size_t i = 0; i < src->size; i++) {
+    size_t len = strlen(src->entries[i]->word);
+    bytes += ARENA_ROUND(sizeof(word_count_t) + len + 1);
+  }
+  return reserve_entries(dst, size) &&
+         (bytes == 0 || arena_reserve(&dst->arena, bytes));
+}
+
+/* Locks two lists in address order, so that opposite merges cannot deadlock. */
+static void lock_pair(word_count_list_t *a, word_count_list_t *b) {
+  if ((uintptr_t) a > (uintptr_t) b) {
+    word_count_list_t *t = a;
+    a = b;
+    b = t;
+  }
+  LOCK(a);
+  LOCK(b);
+}
+
+bool merge_words(word_count_list_t *dst, word_count_list_t *src) {
+  lock_pair(dst, src);
+  if (!reserve_merge(dst, src)) {
+    UNLOCK(src);
+    UNLOCK(dst);
+    return false;
+  }
+  for (size_t i = 0; i < src->size; i++) {
+    word_count_t *wc = src->entries[i];
+    insert(dst, wc->word, strlen(wc->word), wc->hash, wc->count);
+  }
+
+  /* Release everything src owned and leave it as a fresh, empty table. */
+  while (src->arena != NULL) {
+    struct word_count_arena *next = src->arena->next;
+    free(src->arena);
+    src->arena = next;
+  }
+  memset(src->slots, 0, src->capacity * sizeof *src->slots);
+  src->size = 0;
+  UNLOCK(src);
+  UNLOCK(dst);
+  return true;
+}
+
+void foreach_word(word_count_list_t *wclist,
+                  void fn(word_count_t *, void *), void *aux) {
+  LOCK(wclist);
+  for (size_t i = 0; i < wclist->size; i++) {
+    fn(wclist->entries[i], aux);
+  }
+  UNLOCK(wclist);
+}
+
+void fprint_words(word_count_list_t *wclist, FILE *outfile) {
+  LOCK(wclist);
+  for (size_t i = 0; i < wclist->size; i++) {
+    word_count_t *wc = wclist->entries[i];
+    fprintf(outfile, "%8d\t%s\n", wc->count, wc->word);
+  }
+  UNLOCK(wclist);
+}
+
+/* Stable merge sort of SRC[0..N) into DST, using TMP as scratch. */
+static void merge_sort(word_count_t **src, word_count_t **tmp, size_t n,
+                       bool less(const word_count_t *, const word_count_t *)) {
+  if (n < 2) {
+    return;
+  }
+  size_t mid = n / 2;
+  merge_sort(src, tmp, mid, less);
+  merge_sort(src + mid, tmp, n - mid, less);
+
+  size_t i = 0, j = mid, k = 0;
+  while (i < mid && j < n) {
+    tmp[k++] = less(src[j], src[i]) ? src[j++] : src[i++];
+  }
+  while (i < mid) {
+    tmp[k++] = src[i++];
+  }
+  while (j < n) {
+    tmp[k++] = src[j++];
+  }
+  memcpy(src, tmp, n * sizeof *src);
+}
+
+void wordcount_sort(word_count_list_t *wclist,
+                    bool less(const word_count_t *, const word_count_t *)) {
+  LOCK(wclist);
+  word_count_t **tmp = malloc((wclist->size + 1) * sizeof *tmp);
+  if (tmp == NULL) {
+    perror("malloc");
+  } else {
+    merge_sort(wclist->entries, tmp, wclist->size, less);
+    free(tmp);
+
+    /*
+     * Entries moved, so rebuild the slots from each entry's cached hash and
+     * new position. Looking the words up instead would compare against
+     * entries through indexes that are already stale.
+     */
+    memset(wclist->slots, 0, wclist->capacity * sizeof *wclist->slots);
+    for (size_t i = 0; i < wclist->size; i++) {
+      struct word_count_slot slot = { wclist->entries[i]->hash, i + 1 };
+      place(wclist->slots, wclist->capacity, slot);
+    }
+  }
+  UNLOCK(wclist);
+}
@@ -29,6 +29,7 @@
 #endif
 
 #include "word_count.h"
+#include <stdint.h>
 
 void init_words(word_count_list_t *wclist) {
   /* TODO */
@@ -83,6 +84,65 @@ word_count_t *add_word(word_count_list_t *wclist, char *word) {
   return wc; 
 }
 
+word_count_t *add_word_len(word_count_list_t *wclist, const char *word,
+                           size_t len) {
+  /* Make an owned, terminated copy and hand it to add_word. */
+  word_count_t *wc = NULL;
+  char *copy = malloc(len + 1);
+  if (copy == NULL) {
+    perror("malloc");
+  } else {
+    memcpy(copy, word, len);
+    copy[len] = '\0';
+    if ((wc = add_word(wclist, copy)) == NULL) {
+      free(copy);
+    }
+  }
+  return wc;
+}
+
+bool merge_words(word_count_list_t *dst, word_count_list_t *src) {
+  /* Lock in address order, so that opposite merges cannot deadlock. */
+  word_count_list_t *first = (uintptr_t) dst < (uintptr_t) src ? dst : src;
+  word_count_list_t *second = first == dst ? src : dst;
+  pthread_mutex_lock(&first->lock);
+  pthread_mutex_lock(&second->lock);
+
+  /* Move each entry of src into dst, folding duplicates into dst's entry. */
+  while (!list_empty(&src->lst)) {
+    word_count_t * wc = list_entry(list_pop_front(&src->lst), struct word_count, elem);
+    word_count_t * existing = NULL;
+    struct list_elem * e;
+    for (e = list_begin(&dst->lst); e != list_end(&dst->lst); e = list_next(e)) {
+      word_count_t * cur = list_entry(e, struct word_count, elem);
+      if (strcmp(cur->word, wc->word) == 0) {
+        existing = cur;
+        break;
+      }
+    }
+    if (existing != NULL) {
+      existing->count += wc->count;
+      free(wc->word);
+      free(wc);
+    } else {
+      list_push_front(&dst->lst, &wc->elem);
+    }
+  }
+  pthread_mutex_unlock(&second->lock);
+  pthread_mutex_unlock(&first->lock);
+  return true;
+}
+
+void foreach_word(word_count_list_t *wclist,
+                  void fn(word_count_t *, void *), void *aux) {
+  struct list_elem * e;
+  pthread_mutex_lock(&wclist->lock);
+  for (e = list_begin(&wclist->lst); e != list_end(&wclist->lst); e = list_next(e)) {
+    fn(list_entry(e, struct word_count, elem), aux);
+  }
+  pthread_mutex_unlock(&wclist->lock);
+}
+
 void fprint_words(word_count_list_t *wclist, FILE *outfile) {
   /* TODO */
 	struct list_elem * e;
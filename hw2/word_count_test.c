@@ -0,0 +1,89 @@
+/*
+ * Checks that the hash table word_count implementation can still find and
+ * add words after wordcount_sort() has reordered its entries, and that
+ * merge_words() adds up counts and leaves its source empty but usable.
+ */
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "word_count.h"
+#include "word_helpers.h"
+
+#define NWORDS 5000
+
+static char *word_for(int i) {
+  char *word = malloc(16);
+  assert(word != NULL);
+  snprintf(word, 16, "w%d", i);
+  return word;
+}
+
+/* Every word i was added i % 7 + 1 times. */
+static void check_counts(word_count_list_t *wclist, int extra) {
+  assert(len_words(wclist) == NWORDS);
+  for (int i = 0; i < NWORDS; i++) {
+    char *word = word_for(i);
+    word_count_t *wc = find_word(wclist, word);
+    assert(wc != NULL);
+    assert(strcmp(wc->word, word) == 0);
+    assert(wc->count == i % 7 + 1 + extra);
+    free(word);
+  }
+}
+
+/* Adds every word once more, which must not insert anything new. */
+static void add_again(word_count_list_t *wclist) {
+  for (int i = 0; i < NWORDS; i++) {
+    assert(add_word(wclist, word_for(i)) != NULL);
+  }
+  assert(len_words(wclist) == NWORDS);
+}
+
+/* Merges lists holding each word i once and i % 7 times into one. */
+static void check_merge(void) {
+  word_count_list_t dst, src;
+  init_words(&dst);
+  init_words(&src);
+  for (int i = 0; i < NWORDS; i++) {
+    assert(add_word(&dst, word_for(i)) != NULL);
+    if (i % 7 != 0) {
+      assert(add_word_with_count(&src, word_for(i), i % 7) != NULL);
+    }
+  }
+  assert(merge_words(&dst, &src));
+  assert(len_words(&src) == 0);
+  check_counts(&dst, 0);
+
+  assert(add_word(&src, word_for(0)) != NULL);
+  assert(merge_words(&dst, &src));
+  assert(find_word(&dst, "w0")->count == 2);
+}
+
+int main(void) {
+  word_count_list_t wclist;
+  init_words(&wclist);
+  for (int i = 0; i < NWORDS; i++) {
+    for (int j = 0; j <= i % 7; j++) {
+      assert(add_word(&wclist, word_for(i)) != NULL);
+    }
+  }
+  check_counts(&wclist, 0);
+
+  wordcount_sort(&wclist, less_count);
+  check_counts(&wclist, 0);
+  add_again(&wclist);
+  check_counts(&wclist, 1);
+
+  wordcount_sort(&wclist, less_word);
+  check_counts(&wclist, 1);
+  add_again(&wclist);
+  check_counts(&wclist, 2);
+
+  check_merge();
+
+  printf("word_count_test: all tests passed\n");
+  return 0;
+}
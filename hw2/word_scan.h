@@ -0,0 +1,40 @@
+/*
+ * The word_scan interface splits a buffer into words without allocating per
+ * word. A word is a maximal run of ASCII letters, reported lowercased, which
+ * matches what get_word in word_helpers.c produces in the C locale.
+ */
+
+#ifndef WORD_SCAN_H
+#define WORD_SCAN_H
+
+#include <stddef.h>
+
+/* Scanner implementations. SCAN_AUTO picks the widest one the CPU supports. */
+enum scan_impl {
+  SCAN_AUTO,
+  SCAN_SCALAR,
+  SCAN_SSE2,
+  SCAN_AVX2,
+};
+
+/*
+ * Called once per word. WORD points into a scratch buffer owned by the
+ * scanner, holds LEN lowercase letters followed by a '\0', and is only valid
+ * until the callback returns.
+ */
+typedef void word_fn(const char *word, size_t len, void *aux);
+
+/*
+ * Calls FN on every word in DATA[0..LEN), in order. Returns the number of
+ * words found.
+ */
+size_t scan_words(const char *data, size_t len, word_fn *fn, void *aux);
+
+/*
+ * Forces the implementation used by scan_words. Unsupported choices fall
+ * back to the scalar scanner. The WORD_SCAN environment variable ("scalar",
+ * "sse2" or "avx2") sets the initial choice.
+ */
+void scan_set_impl(enum scan_impl impl);
+
+#endif /* WORD_SCAN_H */
@@ -28,18 +28,38 @@
 #include <stdbool.h>
 #include <stdlib.h>
 #include <assert.h>
+#include <unistd.h>
 
 #include "word_count.h"
 #include "word_helpers.h"
 
 /*
  * main - handle command line and file handles.
+ *
+ * -k N prints only the N most frequent words, and -B writes the full listing
+ * through a bulk output buffer.
  */
 int main(int argc, char *argv[]) {
   /* Create the empty data structure. */
   word_count_list_t word_counts;
   init_words(&word_counts);
 
+  size_t top = 0;
+  bool bulk = false;
+  int opt;
+  while ((opt = getopt(argc, argv, "k:B")) != -1) {
+    if (opt == 'k' && atol(optarg) > 0) {
+      top = atol(optarg);
+    } else if (opt == 'B') {
+      bulk = true;
+    } else {
+      fprintf(stderr, "Usage: %s [-k top] [-B] [file...]\n", argv[0]);
+      return 1;
+    }
+  }
+  argc -= optind - 1;
+  argv += optind - 1;
+
   if (argc <= 1) {
     count_words(&word_counts, stdin);
   } else {
@@ -57,7 +77,15 @@ int main(int argc, char *argv[]) {
   }
 
   /* Output final result. */
-  wordcount_sort(&word_counts, less_count);
-  fprint_words(&word_counts, stdout);
+  if (top > 0) {
+    fprint_top_words(&word_counts, stdout, top, less_count);
+  } else {
+    wordcount_sort(&word_counts, less_count);
+    if (bulk) {
+      fprint_words_bulk(&word_counts, stdout);
+    } else {
+      fprint_words(&word_counts, stdout);
+    }
+  }
   return 0;
 }
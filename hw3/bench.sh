@@ -0,0 +1,46 @@
+#!/bin/sh
+#
+# Pipes a large stream through several stages, once under this shell and once
+# under /bin/sh for reference, and reports the time each took. Then feeds each
+# shell a batch of short commands and reports how many it ran per second.
+#
+# Usage: ./bench.sh [megabytes] [stages] [commands]
+
+mb=${1:-1000}
+stages=${2:-4}
+commands=${3:-2000}
+
+line="head -c ${mb}000000 /dev/zero"
+i=0
+while [ $i -lt "$stages" ]; do
+  line="$line | cat"
+  i=$((i + 1))
+done
+line="$line | wc -c"
+
+echo "$line"
+for sh in "$(dirname "$0")/shell" /bin/sh; do
+  start=$(date +%s%N)
+  out=$(echo "$line" | "$sh")
+  end=$(date +%s%N)
+  printf "%-12s %8d ms  (%s bytes)\n" "$(basename "$sh")" \
+    $(( (end - start) / 1000000 )) "$out"
+done
+
+batch=$(mktemp)
+trap 'rm -f "$batch"' EXIT
+i=0
+while [ $i -lt "$commands" ]; do
+  echo "sleep 0" >> "$batch"
+  i=$((i + 1))
+done
+
+echo "$commands x sleep 0"
+for sh in "$(dirname "$0")/shell" /bin/sh; do
+  start=$(date +%s%N)
+  "$sh" < "$batch"
+  end=$(date +%s%N)
+  ms=$(( (end - start) / 1000000 ))
+  printf "%-12s %8d ms  (%d commands/s)\n" "$(basename "$sh")" "$ms" \
+    $(( commands * 1000 / (ms > 0 ? ms : 1) ))
+done
@@ -0,0 +1,139 @@
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "cmdhash.h"
+
+#define CMDHASH_BUCKETS 64
+
+struct cmdhash_entry {
+  char *name;
+  char *path;
+  unsigned int hits;
+  struct cmdhash_entry *next;
+};
+
+static struct cmdhash_entry *buckets[CMDHASH_BUCKETS];
+
+/* The $PATH the entries were resolved against. */
+static char *hashed_path;
+
+static unsigned int hash_name(const char *name) {
+  unsigned int h = 5381;
+  while (*name)
+    h = h * 33 + (unsigned char) *name++;
+  return h % CMDHASH_BUCKETS;
+}
+
+static bool is_executable(const char *path) {
+  struct stat st;
+  return stat(path, &st) == 0 && S_ISREG(st.st_mode) && access(path, X_OK) == 0;
+}
+
+/* Searches each directory of PATH for NAME. Returns a malloc'd path or NULL. */
+static char *search_path(const char *path, const char *name) {
+  size_t name_len = strlen(name);
+  const char *dir = path;
+  while (dir != NULL) {
+    const char *colon = strchr(dir, ':');
+    size_t dir_len = colon ? (size_t) (colon - dir) : strlen(dir);
+    char *full = malloc(dir_len + name_len + 3);
+    if (dir_len == 0) {
+      /* An empty entry means the current directory. */
+      strcpy(full, "./");
+    } else {
+      memcpy(full, dir, dir_len);
+      strcpy(full + dir_len, "/");
+    }
+    strcat(full, name);
+    if (is_executable(full))
+      return full;
+    free(full);
+    dir = colon ? colon + 1 : NULL;
+  }
+  return NULL;
+}
+
+void cmdhash_clear(void) {
+  for (int i = 0; i < CMDHASH_BUCKETS; i++) {
+    while (buckets[i] != NULL) {
+      struct cmdhash_entry *e = buckets[i];
+      buckets[i] = e->next;
+      free(e->name);
+      free(e->path);
+      free(e);
+    }
+  }
+  free(hashed_path);
+  hashed_path = NULL;
+}
+
+const char *cmdhash_lookup(const char *name) {
+  if (name == NULL || *name == '\0')
+    return NULL;
+  if (strchr(name, '/') != NULL)
+    return name;
+
+  /* Entries resolved against another $PATH may now be wrong. */
+  const char *path = getenv("PATH");
+  if (path == NULL)
+    path = "";
+  if (hashed_path == NULL || strcmp(hashed_path, path) != 0) {
+    cmdhash_clear();
+    hashed_path = strdup(path);
+  }
+
+  unsigned int b = hash_name(name);
+  for (struct cmdhash_entry *e = buckets[b]; e != NULL; e = e->next) {
+    if (strcmp(e->name, name) == 0) {
+      e->hits++;
+      return e->path;
+    }
+  }
+
+  char *full = search_path(path, name);
+  if (full == NULL) {
+    /* Like the old exec loop, fall back to a program in the current directory. */
+    return is_executable(name) ? name : NULL;
+  }
+  struct cmdhash_entry *e = malloc(sizeof(struct cmdhash_entry));
+  e->name = strdup(name);
+  e->path = full;
+  e->hits = 1;
+  e->next = buckets[b];
+  buckets[b] = e;
+  return e->path;
+}
+
+void cmdhash_forget(const char *name) {
+  if (name == NULL)
+    return;
+  struct cmdhash_entry **p = &buckets[hash_name(name)];
+  while (*p != NULL) {
+    struct cmdhash_entry *e = *p;
+    if (strcmp(e->name, name) == 0) {
+      *p = e->next;
+      free(e->name);
+      free(e->path);
+      free(e);
+      return;
+    }
+    p = &e->next;
+  }
+}
+
+void cmdhash_print(FILE *out) {
+  bool any = false;
+  for (int i = 0; i < CMDHASH_BUCKETS; i++) {
+    for (struct cmdhash_entry *e = buckets[i]; e != NULL; e = e->next) {
+      if (!any)
+        fprintf(out, "hits\tcommand\n");
+      any = true;
+      fprintf(out, "%4u\t%s\n", e->hits, e->path);
+    }
+  }
+  if (!any)
+    fprintf(out, "hash: hash table empty\n");
+}
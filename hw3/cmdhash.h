@@ -0,0 +1,19 @@
+#pragma once
+
+#include <stdio.h>
+
+/* Remembers where each command was found in $PATH, like bash's `hash`. */
+
+/* Full path of the program NAME names, searching $PATH on a miss. Names
+   containing a slash are returned as is. NULL if there is no such program.
+   The result is owned by the table and valid until it next changes. */
+const char *cmdhash_lookup(const char *name);
+
+/* Drop NAME from the table, e.g. after executing its cached path failed. */
+void cmdhash_forget(const char *name);
+
+/* Drop every entry. */
+void cmdhash_clear(void);
+
+/* Print each remembered command with its hit count. */
+void cmdhash_print(FILE *out);
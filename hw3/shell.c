@@ -7,10 +7,12 @@
 #include <string.h>
 #include <sys/types.h>
 #include <signal.h>
+#include <spawn.h>
 #include <sys/wait.h>
 #include <termios.h>
 #include <unistd.h>
 
+#include "cmdhash.h"
 #include "tokenizer.h"
 
 /* Convenience macro to silence compiler warnings about unused function parameters. */
@@ -32,6 +34,12 @@ int cmd_exit(struct tokens *tokens);
 int cmd_help(struct tokens *tokens);
 int cmd_cd(struct tokens *tokens);
 int cmd_pwd(struct tokens *tokens);
+int cmd_hash(struct tokens *tokens);
+int cmd_jobs(struct tokens *tokens);
+int cmd_fg(struct tokens *tokens);
+int cmd_bg(struct tokens *tokens);
+int cmd_wait(struct tokens *tokens);
+int cmd_parallel(struct tokens *tokens);
 
 /* Built-in command functions take token array (see parse.h) and return int */
 typedef int cmd_fun_t(struct tokens *tokens);
@@ -47,7 +55,14 @@ fun_desc_t cmd_table[] = {
   {cmd_help, "?", "show this help menu"},
   {cmd_exit, "exit", "exit the command shell"},
   {cmd_cd, "cd", "changes the working directory to input"},
-  {cmd_pwd, "pwd", "prints working directory"}
+  {cmd_pwd, "pwd", "prints working directory"},
+  {cmd_hash, "hash", "lists remembered program locations; -r forgets them"},
+  {cmd_jobs, "jobs", "lists background and stopped jobs"},
+  {cmd_fg, "fg", "continues a job (default the latest) in the foreground"},
+  {cmd_bg, "bg", "continues a stopped job in the background"},
+  {cmd_wait, "wait", "waits for a job, or all background jobs, to finish"},
+  {cmd_parallel, "parallel",
+   "parallel [-j N] cmd [arg...] ::: input... runs cmd once per input, N at a time"}
 };
 
 /* Prints a helpful description for the given command */
@@ -75,6 +90,24 @@ int cmd_pwd(unused struct tokens *tokens) {
 	return 1;
 }
 
+/* Like bash: "hash" lists, "hash -r" clears, "hash name..." looks names up. */
+int cmd_hash(struct tokens *tokens) {
+	size_t len = tokens_get_length(tokens);
+	if (len == 1) {
+		cmdhash_print(stdout);
+		return 1;
+	}
+	for (size_t i = 1; i < len; i += 1) {
+		char * name = tokens_get_token(tokens, i);
+		if (strcmp(name, "-r") == 0) {
+			cmdhash_clear();
+		} else if (cmdhash_lookup(name) == NULL) {
+			fprintf(stderr, "hash: %s: not found\n", name);
+		}
+	}
+	return 1;
+}
+
 
 /* Looks up the built-in command, if it exists. */
 int lookup(char cmd[]) {
@@ -84,150 +117,661 @@ int lookup(char cmd[]) {
   return -1;
 }
 
-void run_program(char * path, char ** cmd) {
-	signal(SIGINT, SIG_DFL);
-	signal(SIGQUIT, SIG_DFL);
-	signal(SIGTERM, SIG_DFL);
-	signal(SIGTSTP, SIG_DFL);
-	signal(SIGCONT, SIG_DFL);
-	signal(SIGTTIN, SIG_DFL);
-	signal(SIGTTOU, SIG_DFL);
-	if(execv(path, cmd) < 0) {
-                char buf[1024];
-                char * envpath = strdup(getenv("PATH"));
-                char * p = strtok(envpath, ":");
-                while (p != NULL) {
-                        strcpy(buf, p);
-                        strcpy(buf + strlen(p), "/");
-                        strcpy(buf + strlen(p) + 1, path);
-                        if (execv(buf, cmd) >= 0) {
-                                break;
-                        }
-                        p = strtok(NULL, ":");
-                }
-                free(envpath);
-       }
-}
-
-int run_cmd(struct tokens * tokens, int fd_in, int fd_out) {
-    /* Find which built-in function to run. */	
-
-
-      int fundex = lookup(tokens_get_token(tokens,0));
-      if (fundex >= 0) {
-
-	int save_in = dup(STDIN_FILENO);
-	int save_out = dup(STDOUT_FILENO);
+/* Signals the shell ignores and its jobs must get back. */
+static const int job_signals[] = {
+	SIGINT, SIGQUIT, SIGTERM, SIGTSTP, SIGCONT, SIGTTIN, SIGTTOU
+};
+#define NUM_JOB_SIGNALS (sizeof(job_signals) / sizeof(job_signals[0]))
 
-	if (fd_in != STDIN_FILENO) {
-		dup2(fd_in, STDIN_FILENO);
-		close(fd_in);	
+/* Restores default signal handling in a child before it runs a program. */
+void run_program_signals(void) {
+	sigset_t none;
+	for (size_t i = 0; i < NUM_JOB_SIGNALS; i += 1) {
+		signal(job_signals[i], SIG_DFL);
 	}
+	/* The shell forks with SIGCHLD blocked; see run_pipeline. */
+	sigemptyset(&none);
+	sigprocmask(SIG_SETMASK, &none, NULL);
+}
 
-	if (fd_out != STDOUT_FILENO) {
-		dup2(fd_out, STDOUT_FILENO);
-		close(fd_out);
+/* Replaces the process with the program, found through the path cache. */
+void run_program(char * path, char ** cmd) {
+	const char * full = cmdhash_lookup(path);
+	if (full != NULL) {
+		execv(full, cmd);
 	}
+}
 
-       	cmd_table[fundex].fun(tokens);
-
-	dup2(save_in, STDIN_FILENO);
-	dup2(save_out, STDOUT_FILENO);
-
-	return 0;
-      }
+/* Returns true if the stage ends in a "< file" or "> file" redirection. */
+bool stage_redirects(struct tokens * tokens) {
+	size_t len = tokens_get_length(tokens);
+	if (len <= 2) {
+		return false;
+	}
+	return tokens_is_operator(tokens, len - 2, ">") ||
+		tokens_is_operator(tokens, len - 2, "<");
+}
 
-      int cpid = fork();
-      if (cpid == 0) {
+/*
+ * Starts the program CMD with posix_spawn, which glibc implements with a
+ * vfork-style clone instead of copying the shell's page tables. IN_FD and
+ * OUT_FD (or -1) become its stdin and stdout and every pipe end in
+ * FDS[0..NFDS) is closed. With JOB_CONTROL it joins process group PGID (0 for
+ * a new group of its own) and gets every job signal back; otherwise it stays
+ * in the shell's group and only gets back the ones that terminate it, so it
+ * can be interrupted but not stopped. Returns the pid, or -1 if it didn't
+ * start.
+ */
+pid_t spawn_program(char ** cmd, int in_fd, int out_fd, int * fds, size_t nfds,
+		pid_t pgid, bool job_control) {
+	extern char ** environ;
+	posix_spawn_file_actions_t actions;
+	posix_spawn_file_actions_init(&actions);
+	if (in_fd >= 0) {
+		posix_spawn_file_actions_adddup2(&actions, in_fd, STDIN_FILENO);
+	}
+	if (out_fd >= 0) {
+		posix_spawn_file_actions_adddup2(&actions, out_fd, STDOUT_FILENO);
+	}
+	for (size_t i = 0; i < nfds; i += 1) {
+		posix_spawn_file_actions_addclose(&actions, fds[i]);
+	}
 
-	      setpgid(0, 0);
+	posix_spawnattr_t attr;
+	sigset_t defaults;
+	sigset_t none;
+	sigemptyset(&defaults);
+	if (job_control) {
+		for (size_t i = 0; i < NUM_JOB_SIGNALS; i += 1) {
+			sigaddset(&defaults, job_signals[i]);
+		}
+	} else {
+		sigaddset(&defaults, SIGINT);
+		sigaddset(&defaults, SIGQUIT);
+		sigaddset(&defaults, SIGTERM);
+	}
+	sigemptyset(&none);
+	posix_spawnattr_init(&attr);
+	posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGDEF | POSIX_SPAWN_SETSIGMASK |
+			(job_control ? POSIX_SPAWN_SETPGROUP : 0));
+	posix_spawnattr_setpgroup(&attr, pgid);
+	posix_spawnattr_setsigdefault(&attr, &defaults);
+	posix_spawnattr_setsigmask(&attr, &none);
+
+	/* A stale cache entry gets one retry with a fresh PATH search. */
+	pid_t cpid = -1;
+	for (int attempt = 0; attempt < 2 && cpid < 0; attempt += 1) {
+		const char * full = cmdhash_lookup(cmd[0]);
+		if (full == NULL) {
+			break;
+		}
+		if (posix_spawn(&cpid, full, &actions, &attr, cmd, environ) != 0) {
+			cpid = -1;
+			cmdhash_forget(cmd[0]);
+		}
+	}
+	if (cpid < 0) {
+		fprintf(stderr, "%s: command not found\n", cmd[0]);
+	}
 
-	      //tcsetpgrp(0, getpgrp());
-	      
-	      if (fd_in != STDIN_FILENO) {
-	      	dup2(fd_in, STDIN_FILENO);
-		close(fd_in);
-	      }
+	posix_spawnattr_destroy(&attr);
+	posix_spawn_file_actions_destroy(&actions);
+	return cpid;
+}
 
-	      if (fd_out != STDOUT_FILENO) {
-	      	dup2(fd_out, STDOUT_FILENO);
-		close(fd_out);
-	      }
+/* Spawns a pipeline stage that needs no builtin or redirection work. */
+pid_t spawn_stage(struct tokens * tokens, int in_fd, int out_fd,
+		int * fds, size_t nfds, pid_t pgid) {
+	size_t len = tokens_get_length(tokens);
+	char * cmd[len + 1];
+	for (size_t i = 0; i < len; i += 1) {
+		cmd[i] = tokens_get_token(tokens, i);
+	}
+	cmd[len] = NULL;
+	return spawn_program(cmd, in_fd, out_fd, fds, nfds, pgid, true);
+}
 
-	      int fundex = lookup(tokens_get_token(tokens, 0));
+/*
+ * Runs one pipeline stage in a forked child: applies a trailing "< file" or
+ * "> file" redirection and replaces the process with the program, or runs the
+ * builtin if the stage names one. Never returns.
+ */
+void exec_stage(struct tokens * tokens) {
+	if (tokens_get_length(tokens) == 0) {
+		_exit(0);
+	}
 
-	      if (fundex >= 0) {
-	      	cmd_table[fundex].fun(tokens);
-		return 0;
-	      }
+	int fundex = lookup(tokens_get_token(tokens, 0));
+	if (fundex >= 0) {
+		cmd_table[fundex].fun(tokens);
+		exit(0);
+	}
 
-	      //SETUP REDIRECTION
-	      size_t len = tokens_get_length(tokens);
-	      bool in = false;
-	      bool out = false;
-	      if (len > 2) {
-	      	if (strcmp(tokens_get_token(tokens, len - 2), ">") == 0) {
+	//SETUP REDIRECTION
+	size_t len = tokens_get_length(tokens);
+	bool in = false;
+	bool out = false;
+	if (len > 2) {
+		if (tokens_is_operator(tokens, len - 2, ">")) {
 			out = true;
 			len -= 2;
-		} else if (strcmp(tokens_get_token(tokens, len - 2), "<") == 0) {
+		} else if (tokens_is_operator(tokens, len - 2, "<")) {
 			in = true;
 			len -= 2;
 		}
-	      }
+	}
 
-	  
-	      if (out) {
-	      	int fd = open(tokens_get_token(tokens, tokens_get_length(tokens) - 1),
+	if (out) {
+		int fd = open(tokens_get_token(tokens, tokens_get_length(tokens) - 1),
 				O_WRONLY | O_APPEND | O_CREAT, 0777);
-		if (fd < 0)
+		if (fd < 0) {
 			perror("ERROR FINDING FILE");
+			_exit(1);
+		}
 		dup2(fd, STDOUT_FILENO);
 		close(fd);
-	      }
+	}
 
-	      if (in) {
+	if (in) {
 		int fd = open(tokens_get_token(tokens, tokens_get_length(tokens) - 1),
 				O_RDONLY);
-		if (fd < 0)
+		if (fd < 0) {
 			perror("ERROR FINDING FILE");
+			_exit(1);
+		}
 		dup2(fd, STDIN_FILENO);
 		close(fd);
-	      } 
-
- 	      char * cmd[len];
-              for (int i = 0; i < len; i += 1) {
-                 cmd[i] = tokens_get_token(tokens, i);
-              }
-              cmd[len] = NULL;
-
-	      run_program(cmd[0], cmd);
-	      
-	      return 0;
-      
-      } else if (cpid > 0){
-
-	      if (fd_in != STDIN_FILENO) {
-                close(fd_in);
-              }
-
-              if (fd_out != STDOUT_FILENO) {
-                close(fd_out);
-              }
-
-	      setpgid(cpid, cpid);
-	      
-	      tcsetpgrp(shell_terminal, cpid);
-
-	      int status;
-	      waitpid(cpid, &status, WUNTRACED);
-	    
-	      tcsetpgrp(shell_terminal, shell_pgid); 
-
-      } else {
-      	perror("can't run the executable");
-      }
-    
-    return 0;
+	}
+
+	char * cmd[len + 1];
+	for (int i = 0; i < len; i += 1) {
+		cmd[i] = tokens_get_token(tokens, i);
+	}
+	cmd[len] = NULL;
+
+	run_program(cmd[0], cmd);
+
+	fprintf(stderr, "%s: command not found\n", cmd[0]);
+	_exit(127);
+}
+
+/* A process started for a job. */
+typedef struct process {
+	pid_t pid;
+	char * name;        /* Program it ran, to forget its path on exit 127. */
+	int status;         /* As reported by waitpid. */
+	bool completed;
+	bool stopped;
+} process_t;
+
+/* A pipeline, or a parallel batch, and the processes running it. */
+typedef struct job {
+	int id;
+	pid_t pgid;
+	char * command;
+	process_t * procs;
+	size_t nprocs;
+	bool notify;        /* Report "Done" once it finishes. */
+	struct job * next;
+} job_t;
+
+/*
+ * Every unfinished job, oldest first. The SIGCHLD handler updates the
+ * processes in it, so everything else blocks SIGCHLD while it looks.
+ */
+job_t * first_job;
+
+void block_sigchld(sigset_t * old) {
+	sigset_t set;
+	sigemptyset(&set);
+	sigaddset(&set, SIGCHLD);
+	sigprocmask(SIG_BLOCK, &set, old);
+}
+
+/* Waits for a SIGCHLD. Must be called with SIGCHLD blocked. */
+void await_sigchld(void) {
+	sigset_t mask;
+	sigprocmask(SIG_BLOCK, NULL, &mask);
+	sigdelset(&mask, SIGCHLD);
+	sigsuspend(&mask);
+}
+
+/* Adds a job with room for MAXPROCS processes to the end of the table. */
+job_t * job_new(const char * command, size_t maxprocs) {
+	job_t * job = malloc(sizeof(job_t));
+	job->id = 1;
+	job->pgid = 0;
+	job->command = strdup(command);
+	job->procs = malloc(sizeof(process_t) * (maxprocs ? maxprocs : 1));
+	job->nprocs = 0;
+	job->notify = false;
+	job->next = NULL;
+
+	job_t ** p = &first_job;
+	while (*p != NULL) {
+		job->id = (*p)->id + 1;
+		p = &(*p)->next;
+	}
+	*p = job;
+	return job;
+}
+
+void job_add_process(job_t * job, pid_t pid, const char * name) {
+	process_t * proc = &job->procs[job->nprocs++];
+	proc->pid = pid;
+	proc->name = strdup(name);
+	proc->status = 0;
+	proc->completed = false;
+	proc->stopped = false;
+}
+
+/* Removes JOB from the table and frees it. */
+void job_free(job_t * job) {
+	job_t ** p = &first_job;
+	while (*p != job) {
+		p = &(*p)->next;
+	}
+	*p = job->next;
+	for (size_t i = 0; i < job->nprocs; i += 1) {
+		free(job->procs[i].name);
+	}
+	free(job->procs);
+	free(job->command);
+	free(job);
+}
+
+bool job_completed(job_t * job) {
+	for (size_t i = 0; i < job->nprocs; i += 1) {
+		if (!job->procs[i].completed) {
+			return false;
+		}
+	}
+	return true;
+}
+
+/* True once no process of JOB is running. */
+bool job_stopped(job_t * job) {
+	for (size_t i = 0; i < job->nprocs; i += 1) {
+		if (!job->procs[i].completed && !job->procs[i].stopped) {
+			return false;
+		}
+	}
+	return true;
+}
+
+size_t job_running(job_t * job) {
+	size_t n = 0;
+	for (size_t i = 0; i < job->nprocs; i += 1) {
+		n += !job->procs[i].completed;
+	}
+	return n;
+}
+
+/* Records a status change reported by waitpid. Called from the handler. */
+void mark_process_status(pid_t pid, int status) {
+	for (job_t * job = first_job; job != NULL; job = job->next) {
+		for (size_t i = 0; i < job->nprocs; i += 1) {
+			process_t * proc = &job->procs[i];
+			if (proc->pid != pid) {
+				continue;
+			}
+			if (WIFSTOPPED(status)) {
+				proc->stopped = true;
+			} else if (WIFCONTINUED(status)) {
+				proc->stopped = false;
+			} else {
+				proc->completed = true;
+				proc->status = status;
+			}
+			return;
+		}
+	}
+}
+
+/* Reaps every child that changed state, without blocking. */
+void sigchld_handler(unused int sig) {
+	int saved_errno = errno;
+	int status;
+	pid_t pid;
+	while ((pid = waitpid(-1, &status, WNOHANG | WUNTRACED | WCONTINUED)) > 0) {
+		mark_process_status(pid, status);
+	}
+	errno = saved_errno;
+}
+
+void print_job(job_t * job, const char * state) {
+	fprintf(stdout, "[%d]  %-8s  %s\n", job->id, state, job->command);
+}
+
+/*
+ * Waits in the foreground until JOB finishes or stops, with the terminal
+ * given to it. Frees the job if it finished. Must be called with SIGCHLD
+ * blocked.
+ */
+void wait_foreground(job_t * job) {
+	if (shell_is_interactive) {
+		tcsetpgrp(shell_terminal, job->pgid);
+	}
+	while (!job_stopped(job)) {
+		await_sigchld();
+	}
+	if (shell_is_interactive) {
+		tcsetpgrp(shell_terminal, shell_pgid);
+	}
+
+	if (!job_completed(job)) {
+		job->notify = true;
+		fprintf(stdout, "\n");
+		print_job(job, "Stopped");
+		return;
+	}
+	for (size_t i = 0; i < job->nprocs; i += 1) {
+		/* A forked child exits 127 when the cached path no longer runs. */
+		int status = job->procs[i].status;
+		if (WIFEXITED(status) && WEXITSTATUS(status) == 127) {
+			cmdhash_forget(job->procs[i].name);
+		}
+	}
+	job_free(job);
+}
+
+/* Resumes every stopped process of JOB. */
+void continue_job(job_t * job) {
+	for (size_t i = 0; i < job->nprocs; i += 1) {
+		job->procs[i].stopped = false;
+	}
+	kill(-job->pgid, SIGCONT);
+}
+
+/*
+ * Reports and frees the jobs that finished since the last prompt. Like other
+ * shells, only an interactive shell says so.
+ */
+void do_job_notification(void) {
+	sigset_t old;
+	block_sigchld(&old);
+	job_t * job = first_job;
+	while (job != NULL) {
+		job_t * next = job->next;
+		if (job_completed(job)) {
+			if (shell_is_interactive && job->notify) {
+				print_job(job, "Done");
+			}
+			job_free(job);
+		}
+		job = next;
+	}
+	sigprocmask(SIG_SETMASK, &old, NULL);
+}
+
+/*
+ * Finds the job named by the builtin's first argument ("%N" or "N"), or the
+ * latest job if there is none. Must be called with SIGCHLD blocked.
+ */
+job_t * find_job(struct tokens * tokens, const char * builtin) {
+	char * arg = tokens_get_token(tokens, 1);
+	job_t * found = NULL;
+	for (job_t * job = first_job; job != NULL; job = job->next) {
+		if (arg == NULL || job->id == atoi(arg + (arg[0] == '%'))) {
+			found = job;
+		}
+	}
+	if (found == NULL) {
+		fprintf(stderr, "%s: %s: no such job\n", builtin, arg ? arg : "current");
+	}
+	return found;
+}
+
+int cmd_jobs(unused struct tokens *tokens) {
+	sigset_t old;
+	block_sigchld(&old);
+	for (job_t * job = first_job; job != NULL; job = job->next) {
+		if (job_completed(job)) {
+			print_job(job, "Done");
+		} else {
+			print_job(job, job_stopped(job) ? "Stopped" : "Running");
+		}
+	}
+	sigprocmask(SIG_SETMASK, &old, NULL);
+	do_job_notification();
+	return 1;
+}
+
+int cmd_fg(struct tokens *tokens) {
+	sigset_t old;
+	block_sigchld(&old);
+	job_t * job = find_job(tokens, "fg");
+	if (job != NULL) {
+		fprintf(stdout, "%s\n", job->command);
+		continue_job(job);
+		wait_foreground(job);
+	}
+	sigprocmask(SIG_SETMASK, &old, NULL);
+	return 1;
+}
+
+int cmd_bg(struct tokens *tokens) {
+	sigset_t old;
+	block_sigchld(&old);
+	job_t * job = find_job(tokens, "bg");
+	if (job != NULL) {
+		continue_job(job);
+		job->notify = true;
+		fprintf(stdout, "[%d]  %s &\n", job->id, job->command);
+	}
+	sigprocmask(SIG_SETMASK, &old, NULL);
+	return 1;
+}
+
+/* Waits for the given job, or for every job that isn't stopped, to finish. */
+int cmd_wait(struct tokens *tokens) {
+	sigset_t old;
+	block_sigchld(&old);
+	if (tokens_get_length(tokens) > 1) {
+		job_t * job = find_job(tokens, "wait");
+		while (job != NULL && !job_stopped(job)) {
+			await_sigchld();
+		}
+	} else {
+		for (job_t * job = first_job; job != NULL; job = job->next) {
+			while (!job_stopped(job)) {
+				await_sigchld();
+			}
+		}
+	}
+	/* Whoever waited has seen the result; don't also report it. */
+	for (job_t * job = first_job; job != NULL; job = job->next) {
+		if (job_completed(job)) {
+			job->notify = false;
+		}
+	}
+	sigprocmask(SIG_SETMASK, &old, NULL);
+	do_job_notification();
+	return 1;
+}
+
+/*
+ * Runs CMD once per input, with "{}" arguments replaced by the input or the
+ * input appended if there are none, keeping at most N (default one per CPU)
+ * running at once. The commands stay in the shell's process group so ^C
+ * reaches them, and share its stdout, so their output may interleave.
+ */
+int cmd_parallel(struct tokens *tokens) {
+	size_t len = tokens_get_length(tokens);
+	long max_running = sysconf(_SC_NPROCESSORS_ONLN);
+	size_t first = 1;
+	if (len > 2 && strcmp(tokens_get_token(tokens, 1), "-j") == 0) {
+		max_running = atol(tokens_get_token(tokens, 2));
+		first = 3;
+	}
+	size_t sep = first;
+	while (sep < len && strcmp(tokens_get_token(tokens, sep), ":::") != 0) {
+		sep += 1;
+	}
+	if (sep == first || sep == len || max_running < 1) {
+		fprintf(stderr, "usage: parallel [-j N] command [arg...] ::: input...\n");
+		return 1;
+	}
+
+	size_t ncmd = sep - first;
+	size_t ninputs = len - sep - 1;
+	char * cmd[ncmd + 2];
+	size_t failed = 0;
+
+	fflush(stdout);
+	sigset_t old;
+	block_sigchld(&old);
+	job_t * job = job_new("parallel", ninputs);
+	for (size_t i = 0; i < ninputs; i += 1) {
+		char * input = tokens_get_token(tokens, sep + 1 + i);
+		bool substituted = false;
+		for (size_t j = 0; j < ncmd; j += 1) {
+			cmd[j] = tokens_get_token(tokens, first + j);
+			if (strcmp(cmd[j], "{}") == 0) {
+				cmd[j] = input;
+				substituted = true;
+			}
+		}
+		cmd[ncmd] = substituted ? NULL : input;
+		cmd[ncmd + 1] = NULL;
+
+		while (job_running(job) >= (size_t) max_running) {
+			await_sigchld();
+		}
+		pid_t cpid = spawn_program(cmd, -1, -1, NULL, 0, 0, false);
+		if (cpid < 0) {
+			failed += 1;
+		} else {
+			job_add_process(job, cpid, cmd[0]);
+		}
+	}
+	while (!job_completed(job)) {
+		await_sigchld();
+	}
+
+	for (size_t i = 0; i < job->nprocs; i += 1) {
+		int status = job->procs[i].status;
+		if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+			failed += 1;
+		}
+	}
+	job_free(job);
+	sigprocmask(SIG_SETMASK, &old, NULL);
+
+	if (failed > 0) {
+		fprintf(stderr, "parallel: %zu of %zu commands failed\n", failed, ninputs);
+	}
+	return 1;
+}
+
+/*
+ * Runs the N stages of a pipeline. A lone builtin runs inside the shell.
+ * Otherwise every stage is started up front into one process group, wired to
+ * its neighbours with pipes, and the whole job is waited for together, so a
+ * producer never blocks on a consumer that has not started yet. Plain
+ * programs are spawned; builtins and redirections need a forked child. A
+ * BACKGROUND job is left running in the job table under COMMAND.
+ */
+void run_pipeline(struct tokens ** stages, size_t n, const char * command,
+		bool background) {
+	if (n == 0 || tokens_get_length(stages[0]) == 0) {
+		return;
+	}
+
+	int fundex = lookup(tokens_get_token(stages[0], 0));
+	if (n == 1 && fundex >= 0) {
+		cmd_table[fundex].fun(stages[0]);
+		return;
+	}
+
+	/* Pipe i connects stage i to stage i + 1. */
+	int * fd = malloc(sizeof(int) * 2 * n);
+	size_t npipes = 0;
+	for (; npipes < n - 1; npipes += 1) {
+		if (pipe(fd + 2 * npipes) < 0) {
+			perror("pipe");
+			break;
+		}
+	}
+
+	/* Don't let children inherit and flush our buffered output. */
+	fflush(stdout);
+
+	/* Keep the handler from reaping a child before it is in the table. */
+	sigset_t old;
+	block_sigchld(&old);
+	job_t * job = job_new(command, n);
+
+	pid_t pgid = 0;
+	size_t launched = 0;
+	if (npipes == n - 1) {
+		for (; launched < n; launched += 1) {
+			struct tokens * stage = stages[launched];
+			int in_fd = launched > 0 ? fd[2 * (launched - 1)] : -1;
+			int out_fd = launched < n - 1 ? fd[2 * launched + 1] : -1;
+			pid_t cpid;
+			if (tokens_get_length(stage) > 0 &&
+					lookup(tokens_get_token(stage, 0)) < 0 &&
+					!stage_redirects(stage)) {
+				cpid = spawn_stage(stage, in_fd, out_fd, fd, 2 * npipes, pgid);
+				if (cpid < 0) {
+					/* The rest of the job still runs, reading EOF from this stage. */
+					continue;
+				}
+			} else {
+				/* Resolve here so the child finds the path in its copy of the cache. */
+				if (tokens_get_length(stage) > 0) {
+					cmdhash_lookup(tokens_get_token(stage, 0));
+				}
+				cpid = fork();
+				if (cpid == 0) {
+					setpgid(0, pgid);
+					if (in_fd >= 0) {
+						dup2(in_fd, STDIN_FILENO);
+					}
+					if (out_fd >= 0) {
+						dup2(out_fd, STDOUT_FILENO);
+					}
+					/* Close every pipe end so readers see EOF when writers exit. */
+					for (size_t i = 0; i < 2 * npipes; i += 1) {
+						close(fd[i]);
+					}
+					run_program_signals();
+					exec_stage(stage);
+				} else if (cpid < 0) {
+					perror("can't run the executable");
+					break;
+				}
+			}
+
+			/* Set the group here too, in case the child hasn't yet. */
+			if (pgid == 0) {
+				pgid = cpid;
+			}
+			setpgid(cpid, pgid);
+			char * name = tokens_get_token(stage, 0);
+			job_add_process(job, cpid, name ? name : "");
+		}
+	}
+
+	for (size_t i = 0; i < 2 * npipes; i += 1) {
+		close(fd[i]);
+	}
+
+	job->pgid = pgid;
+	if (job->nprocs == 0) {
+		job_free(job);
+	} else if (background) {
+		job->notify = true;
+		if (shell_is_interactive) {
+			fprintf(stdout, "[%d] %d\n", job->id, pgid);
+		}
+	} else {
+		wait_foreground(job);
+	}
+	sigprocmask(SIG_SETMASK, &old, NULL);
+
+	free(fd);
 }
 
 /* Intialization procedures for this shell */
@@ -264,6 +808,29 @@ void init_shell() {
         signal(SIGCONT, SIG_IGN);
         signal(SIGTTIN, SIG_IGN);
         signal(SIGTTOU, SIG_IGN);
+
+	/* Jobs are reaped as they change state; see sigchld_handler. */
+	struct sigaction sa;
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = sigchld_handler;
+	sa.sa_flags = SA_RESTART;
+	sigemptyset(&sa.sa_mask);
+	sigaction(SIGCHLD, &sa, NULL);
+}
+
+/* Trims LINE down to the command a job runs, for listing it. */
+void trim_command(char * line, bool background) {
+	size_t len = strlen(line);
+	while (len > 0 && isspace((unsigned char) line[len - 1])) {
+		len -= 1;
+	}
+	if (background && len > 0 && line[len - 1] == '&') {
+		len -= 1;
+		while (len > 0 && isspace((unsigned char) line[len - 1])) {
+			len -= 1;
+		}
+	}
+	line[len] = '\0';
 }
 
 int main(unused int argc, unused char *argv[]) {
@@ -277,172 +844,48 @@ int main(unused int argc, unused char *argv[]) {
     fprintf(stdout, "%d: ", line_num);
 
   while (fgets(line, 4096, stdin)) {
-    /* Split our line into words. */
-    size_t arr_size = 1;
-    struct tokens ** tokens_arr = malloc(sizeof(struct tokens *) * arr_size);
-
-    size_t cur_size = 0;
-    char * cur;
-    char * save;
-    for (cur = strtok_r(line, "|", &save); cur != NULL; cur = strtok_r(NULL, "|", &save)) {
-	   struct tokens * t = tokenize(cur);
-	   if (arr_size == cur_size) {
-		arr_size = arr_size * 2;
-	   	tokens_arr = realloc(tokens_arr, arr_size * sizeof(struct tokens *));
-	   }
-	   tokens_arr[cur_size] = t;
-	   cur_size += 1;
+    /* Split our line into words, and the words into pipeline stages. */
+    struct tokens * tokens = tokenize(line);
+    size_t len = tokens_get_length(tokens);
+    bool background = len > 0 && tokens_is_operator(tokens, len - 1, "&");
+    if (background) {
+      len -= 1;
     }
 
-    /*Make some pipes*/
-    int fd[2 * (cur_size - 1)];
-    for (int i = 0; i < 2 * (cur_size - 1); i += 2) {
-    	pipe(fd + i);
+    size_t nstages = 1;
+    bool misplaced_amp = false;
+    for (size_t i = 0; i < len; i += 1) {
+      nstages += tokens_is_operator(tokens, i, "|");
+      misplaced_amp |= tokens_is_operator(tokens, i, "&");
     }
-
-    /*Run the command, pipes if included*/
-    if (cur_size > 1) {
-	run_cmd(tokens_arr[0], STDIN_FILENO, fd[1]);
-	int cur_read = 0;
-    	for (int i = 1; i < cur_size - 1; i += 1) {
-		run_cmd(tokens_arr[i], fd[cur_read], fd[cur_read + 3]);
-		cur_read += 2;
-	}
-	run_cmd(tokens_arr[cur_size - 1], fd[2 * (cur_size - 1) - 2], STDOUT_FILENO);
-    } else { 
-    	run_cmd(tokens_arr[0], STDIN_FILENO, STDOUT_FILENO);
+    struct tokens * stages[nstages];
+    size_t start = 0;
+    size_t cur = 0;
+    for (size_t i = 0; i <= len; i += 1) {
+      if (i == len || tokens_is_operator(tokens, i, "|")) {
+        stages[cur++] = tokens_slice(tokens, start, i);
+        start = i + 1;
+      }
     }
 
-    /*if (true) {
-	   struct tokens * tokens = tokens_arr[0];
-	   int cpid = fork();
-	   if (cpid == 0) {
-		int len = tokens_get_length(tokens);
-
-		close(fd[0]);
-	   	dup2(fd[1], STDOUT_FILENO);
-		close(fd[1]);
-
-		char * cmd[len + 1];
-              	for (int i = 0; i < len; i += 1) {
-                 	cmd[i] = tokens_get_token(tokens, i);
-              	}
-              	cmd[len] = NULL;
-              	
-		char buf[16] = "go bears";
-		write(STDOUT_FILENO, buf, 16);
-		return 0;
-	   } else {
-		waitpid(cpid, NULL, 0);
-	   }
-
-	   tokens = tokens_arr[1];
-
-	   int rc = fork();
-	   if (rc == 0) {
-		int len = tokens_get_length(tokens);
-		
-		close(fd[1]);
-		dup2(fd[0], STDIN_FILENO);
-		close(fd[0]);
-
-		char * cmd[len + 1];
-                for (int i = 0; i < len; i += 1) {
-                        cmd[i] = tokens_get_token(tokens, i);
-                }
-                cmd[len] = NULL;
-               
-	   	return 0;
-	   } else {
-		close(fd[0]);
-		close(fd[1]);
-		waitpid(rc, NULL, 0);	
-	   }
-    }*/
-
-    /* for (size_t i = 0; i < cur_size; i += 1) {
-	    run_cmd(tokens_arr[i]);
-    } */   
-
-    /* Find which built-in function to run. */
-//    int fundex = lookup(tokens_get_token(tokens, 0));
-
-   // if (fundex >= 0) {
-     // cmd_table[fundex].fun(tokens);
-    //} else {
-      /* REPLACE this to run commands as programs. */
-      //fprintf(stdout, "This shell doesn't know how to run programs.\n");
-      //int cpid = fork();
-      /*if (cpid == 0) {
-	      
-
-	      //SETUP REDIRECTION
-	      size_t len = tokens_get_length(tokens);
-	      bool in = false;
-	      bool out = false;
-	      if (len > 2) {
-	      	if (strcmp(tokens_get_token(tokens, len - 2), ">") == 0) {
-			out = true;
-		} else if (strcmp(tokens_get_token(tokens, len - 2), "<") == 0) {
-			in = true;
-		}
-	      }
-
-	  
-	      if (out) {
-	      	int fd = open(tokens_get_token(tokens, tokens_get_length(tokens) - 1),
-				O_WRONLY | O_APPEND | O_CREAT, 0777);
-		if (fd < 0)
-			perror("ERROR FINDING FILE");
-		dup2(fd, STDOUT_FILENO);
-		close(fd);
-	      }
-
-	      if (in) {
-		int fd = open(tokens_get_token(tokens, tokens_get_length(tokens) - 1),
-				O_RDONLY);
-		if (fd < 0)
-			perror("ERROR FINDING FILE");
-		dup2(fd, STDIN_FILENO);
-		close(fd);
-	      }
+    /*Run the command, with all stages of a pipeline at once*/
+    if (misplaced_amp) {
+      fprintf(stderr, "syntax error: '&' must end the line\n");
+    } else {
+      trim_command(line, background);
+      run_pipeline(stages, nstages, line, background);
+    }
 
-	      //SETUP AND RUN IF REDIRECT
-	      if (in || out) {
-	      	char * cmd[len];
-              	for (int i = 0; i < len - 2; i += 1) {
-                  cmd[i] = tokens_get_token(tokens, i);
-		}
-		cmd[len - 2] = NULL;
-		run_program(cmd[0], cmd);
-		return 0;
-	      } 
-
- 	      char * cmd[len];
-              for (int i = 0; i < len; i += 1) {
-                 cmd[i] = tokens_get_token(tokens, i);
-              }
-              cmd[len] = NULL;
-
-	      run_program(cmd[0], cmd);
-	      
-	      return 0;
-      } else if (cpid > 0){
-	      wait(NULL);
-      } else {
-      	perror("can't run the executable");
-      }
-    }*/
+    /* Clean up memory */
+    for (size_t j = 0; j < nstages; j += 1) {
+      tokens_destroy(stages[j]);
+    }
+    tokens_destroy(tokens);
 
+    do_job_notification();
     if (shell_is_interactive)
       /* Please only print shell prompts when standard input is not a tty */
       fprintf(stdout, "%d: ", ++line_num);
-
-    /* Clean up memory */
-    for (size_t j = 0; j < cur_size; j += 1) {
-    	tokens_destroy(tokens_arr[j]);
-    }
-    free(tokens_arr);
   }
 
   return 0;
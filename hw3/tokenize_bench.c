@@ -0,0 +1,100 @@
+/*
+ * Measures tokenizer throughput. Tokenizes every line of the given script, or
+ * of a generated one, a number of times and reports bytes and lines per
+ * second.
+ *
+ * Usage: ./tokenize_bench [-n passes] [script]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "tokenizer.h"
+
+#define GENERATED_LINES 100000
+
+static const char *sample_lines[] = {
+  "ls -l /usr/bin | grep -v '^d' | wc -l\n",
+  "cat < input.txt > output.txt\n",
+  "echo \"hello, world\" 'single quoted' escaped\\ space\n",
+  "sleep 1 &\n",
+  "find . -name '*.c' | xargs grep -n tokenize | sort | uniq -c | sort -rn\n",
+  "parallel -j 4 gzip -9 ::: a.txt b.txt c.txt d.txt e.txt f.txt\n",
+};
+
+/* Reads lines from PATH, or makes some up. Returns them NULL-terminated. */
+static char **load_lines(const char *path, size_t *nlines, size_t *nbytes) {
+  size_t cap = 1024;
+  char **lines = malloc(cap * sizeof(char *));
+  *nlines = 0;
+  *nbytes = 0;
+
+  FILE *f = NULL;
+  if (path != NULL && (f = fopen(path, "r")) == NULL) {
+    perror(path);
+    exit(1);
+  }
+  char buf[4096];
+  for (size_t i = 0;; i++) {
+    const char *line;
+    if (f != NULL) {
+      if (fgets(buf, sizeof(buf), f) == NULL)
+        break;
+      line = buf;
+    } else {
+      if (i == GENERATED_LINES)
+        break;
+      line = sample_lines[i % (sizeof(sample_lines) / sizeof(sample_lines[0]))];
+    }
+    if (*nlines + 1 == cap) {
+      cap *= 2;
+      lines = realloc(lines, cap * sizeof(char *));
+    }
+    lines[(*nlines)++] = strdup(line);
+    *nbytes += strlen(line);
+  }
+  lines[*nlines] = NULL;
+  if (f != NULL)
+    fclose(f);
+  return lines;
+}
+
+int main(int argc, char *argv[]) {
+  int passes = 20;
+  int opt;
+  while ((opt = getopt(argc, argv, "n:")) != -1) {
+    if (opt != 'n' || (passes = atoi(optarg)) <= 0) {
+      fprintf(stderr, "Usage: %s [-n passes] [script]\n", argv[0]);
+      return 1;
+    }
+  }
+
+  size_t nlines, nbytes;
+  char **lines = load_lines(optind < argc ? argv[optind] : NULL, &nlines, &nbytes);
+
+  struct timespec start, end;
+  size_t ntokens = 0;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (int p = 0; p < passes; p++) {
+    for (size_t i = 0; i < nlines; i++) {
+      struct tokens *tokens = tokenize(lines[i]);
+      ntokens += tokens_get_length(tokens);
+      tokens_destroy(tokens);
+    }
+  }
+  clock_gettime(CLOCK_MONOTONIC, &end);
+
+  double secs = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+  printf("%zu lines, %zu bytes, %zu tokens per pass, %d passes\n",
+         nlines, nbytes, ntokens / passes, passes);
+  printf("%.1f MB/s, %.0f lines/s\n",
+         nbytes * (double) passes / secs / 1e6, nlines * (double) passes / secs);
+
+  for (size_t i = 0; i < nlines; i++)
+    free(lines[i]);
+  free(lines);
+  return 0;
+}
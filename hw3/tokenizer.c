@@ -3,25 +3,21 @@
 #include <string.h>
 #include "tokenizer.h"
 
+/*
+ * A line of n bytes yields at most n words (each consumes at least one byte)
+ * holding at most n bytes plus a terminator each, so tokenize sizes one block
+ * for the worst case up front: this header, then the word pointers, the
+ * operator flags and the characters. A slice is a separate header pointing
+ * into another list's arrays.
+ */
 struct tokens {
   size_t tokens_length;
   char **tokens;
-  size_t buffers_length;
-  char **buffers;
+  bool *operators;
 };
 
-static void *vector_push(char ***pointer, size_t *size, void *elem) {
-  *pointer = (char**) realloc(*pointer, sizeof(char *) * (*size + 1));
-  (*pointer)[*size] = elem;
-  *size += 1;
-  return elem;
-}
-
-static void *copy_word(char *source, size_t n) {
-  source[n] = '\0';
-  char *word = (char *) malloc(n + 1);
-  strncpy(word, source, n + 1);
-  return word;
+static bool is_operator_char(char c) {
+  return c == '|' || c == '<' || c == '>' || c == '&';
 }
 
 struct tokens *tokenize(const char *line) {
@@ -29,23 +25,38 @@ struct tokens *tokenize(const char *line) {
     return NULL;
   }
 
-  static char token[4096];
-  size_t n = 0, n_max = 4096;
-  struct tokens *tokens;
   size_t line_length = strlen(line);
-
-  tokens = (struct tokens *) malloc(sizeof(struct tokens));
+  size_t max_tokens = line_length + 1;
+  struct tokens *tokens = malloc(sizeof(struct tokens) +
+                                 max_tokens * sizeof(char *) +
+                                 max_tokens * sizeof(bool) +
+                                 2 * line_length + 1);
+  if (tokens == NULL) {
+    return NULL;
+  }
   tokens->tokens_length = 0;
-  tokens->tokens = NULL;
-  tokens->buffers_length = 0;
-  tokens->buffers = NULL;
+  tokens->tokens = (char **) (tokens + 1);
+  tokens->operators = (bool *) (tokens->tokens + max_tokens);
+
+  /* The word being built starts at word and ends at out. */
+  char *word = (char *) (tokens->operators + max_tokens);
+  char *out = word;
+  bool in_word = false;
+
+#define END_WORD(is_op) do {                                    \
+    *out++ = '\0';                                              \
+    tokens->operators[tokens->tokens_length] = (is_op);         \
+    tokens->tokens[tokens->tokens_length++] = word;             \
+    word = out;                                                 \
+    in_word = false;                                            \
+  } while (0)
 
   const int MODE_NORMAL = 0,
         MODE_SQUOTE = 1,
         MODE_DQUOTE = 2;
   int mode = MODE_NORMAL;
 
-  for (unsigned int i = 0; i < line_length; i++) {
+  for (size_t i = 0; i < line_length; i++) {
     char c = line[i];
     if (mode == MODE_NORMAL) {
       if (c == '\'') {
@@ -54,55 +65,53 @@ struct tokens *tokenize(const char *line) {
         mode = MODE_DQUOTE;
       } else if (c == '\\') {
         if (i + 1 < line_length) {
-          token[n++] = line[++i];
+          *out++ = line[++i];
+          in_word = true;
         }
-      } else if (isspace(c)) {
-        if (n > 0) {
-          void *word = copy_word(token, n);
-          vector_push(&tokens->tokens, &tokens->tokens_length, word);
-          n = 0;
+      } else if (isspace((unsigned char) c)) {
+        if (in_word) {
+          END_WORD(false);
         }
+      } else if (is_operator_char(c)) {
+        if (in_word) {
+          END_WORD(false);
+        }
+        *out++ = c;
+        END_WORD(true);
       } else {
-        token[n++] = c;
+        *out++ = c;
+        in_word = true;
       }
     } else if (mode == MODE_SQUOTE) {
       if (c == '\'') {
         mode = MODE_NORMAL;
       } else if (c == '\\') {
         if (i + 1 < line_length) {
-          token[n++] = line[++i];
+          *out++ = line[++i];
+          in_word = true;
         }
       } else {
-        token[n++] = c;
+        *out++ = c;
+        in_word = true;
       }
     } else if (mode == MODE_DQUOTE) {
       if (c == '"') {
         mode = MODE_NORMAL;
-<<<<<<< HEAD
-	void *word = copy_word(token, n);
-	vector_push(&tokens->tokens, &tokens->tokens_length, word);
-	n = 0;
-=======
-        void *word = copy_word(token, n);
-        vector_push(&tokens->tokens, &tokens->tokens_length, word);
-        n = 0;
->>>>>>> cdb8714abbe6e2a8ddba6c584ac62dcb8ca47568
+        END_WORD(false);
       } else if (c == '\\') {
         if (i + 1 < line_length) {
-          token[n++] = line[++i];
+          *out++ = line[++i];
         }
       } else {
-        token[n++] = c;
+        *out++ = c;
       }
     }
-    if (n + 1 >= n_max) abort();
   }
 
-  if (n > 0) {
-    void *word = copy_word(token, n);
-    vector_push(&tokens->tokens, &tokens->tokens_length, word);
-    n = 0;
+  if (in_word) {
+    END_WORD(false);
   }
+#undef END_WORD
   return tokens;
 }
 
@@ -122,18 +131,31 @@ char *tokens_get_token(struct tokens *tokens, size_t n) {
   }
 }
 
-void tokens_destroy(struct tokens *tokens) {
-  if (tokens == NULL) {
-    return;
-  }
-  for (int i = 0; i < tokens->tokens_length; i++) {
-    free(tokens->tokens[i]);
+bool tokens_is_operator(struct tokens *tokens, size_t n, const char *op) {
+  if (tokens == NULL || n >= tokens->tokens_length) {
+    return false;
   }
-  for (int i = 0; i < tokens->buffers_length; i++) {
-    free(tokens->buffers[i]);
+  return tokens->operators[n] && strcmp(tokens->tokens[n], op) == 0;
+}
+
+struct tokens *tokens_slice(struct tokens *tokens, size_t start, size_t end) {
+  struct tokens *slice = malloc(sizeof(struct tokens));
+  if (slice == NULL) {
+    return NULL;
   }
-  if (tokens->tokens) {
-    free(tokens->tokens);
+  if (tokens == NULL || start >= end || end > tokens->tokens_length) {
+    slice->tokens_length = 0;
+    slice->tokens = NULL;
+    slice->operators = NULL;
+  } else {
+    slice->tokens_length = end - start;
+    slice->tokens = tokens->tokens + start;
+    slice->operators = tokens->operators + start;
   }
+  return slice;
+}
+
+void tokens_destroy(struct tokens *tokens) {
+  /* Either a whole list in one block or just a slice's header. */
   free(tokens);
 }
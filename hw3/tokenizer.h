@@ -1,9 +1,16 @@
 #pragma once
 
+#include <stdbool.h>
+#include <stddef.h>
+
 /* A struct that represents a list of words. */
 struct tokens;
 
-/* Turn a string into a list of words. */
+/*
+ * Turn a string into a list of words. Unquoted |, <, > and & are operators:
+ * they end the current word and become words of their own. The whole list
+ * lives in a single allocation, and tokenize keeps no state between calls.
+ */
 struct tokens *tokenize(const char *line);
 
 /* How many words are there? */
@@ -12,5 +19,12 @@ size_t tokens_get_length(struct tokens *tokens);
 /* Get me the Nth word (zero-indexed) */
 char *tokens_get_token(struct tokens *tokens, size_t n);
 
+/* Is the Nth word the operator OP, as opposed to a word that merely spells it? */
+bool tokens_is_operator(struct tokens *tokens, size_t n, const char *op);
+
+/* Words [start, end) of TOKENS as a list of their own, sharing its storage.
+   Destroy it before TOKENS. */
+struct tokens *tokens_slice(struct tokens *tokens, size_t start, size_t end);
+
 /* Free the memory */
 void tokens_destroy(struct tokens *tokens);
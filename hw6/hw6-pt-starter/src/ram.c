@@ -1,11 +1,20 @@
-/* This simulation of physical memory is really backed by a 1 level page table,
-   but the "chunk" will be used to avoid confusion */
+/* This simulation of physical memory is backed by a single sparse mapping
+   covering all of RAM_SIZE. The mapping is reserved with MAP_NORESERVE, so the
+   host only commits a page when it is first written; reads of memory that was
+   never touched hit the zero page and allocate nothing. The "chunk" table is
+   kept so that images stay in the same on-disk format and ram_save only has to
+   write out the chunks that were actually used. */
 #include "ram.h"
 
+#include <fcntl.h>
+#include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #define RAM_SIZE (1ull << 36)
 
@@ -18,86 +27,197 @@ int32_t chunk_table[MAX_CHUNKS];
 chunk *chunks;
 size_t num_chunks;
 
-chunk *get_chunk(size_t idx) {
-  int32_t chunk_table_entry = chunk_table[idx];
-  if (chunk_table_entry < 0) {
-    chunk_table_entry = num_chunks;
-    chunk_table[idx] = chunk_table_entry;
-    num_chunks++;
-    chunks = realloc(chunks, CHUNK_SIZE * num_chunks);
+/* Records that chunk IDX has been written so ram_save will include it. The
+   value stored is the chunk's position in the image file. */
+static void touch_chunk(size_t idx) {
+  if (chunk_table[idx] < 0) {
+    chunk_table[idx] = num_chunks++;
   }
-  return &chunks[chunk_table_entry];
 }
 
-void ram_init(void) {
+static void reset_chunk_table(void) {
   for (int i = 0; i < MAX_CHUNKS; i++) {
     chunk_table[i] = -1;
   }
-  chunks = NULL;
   num_chunks = 0;
 }
 
+void ram_init(void) {
+  reset_chunk_table();
+  chunks = mmap(NULL, RAM_SIZE, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (chunks == MAP_FAILED) {
+    perror("ram_init: mmap");
+    exit(1);
+  }
+}
+
 void ram_store(paddr_ptr addr, void *buf, size_t len) {
-  while (len) {
-    size_t chunk_idx = addr / CHUNK_SIZE;
-    chunk *chunk = get_chunk(chunk_idx);
-    size_t offset = addr % CHUNK_SIZE;
-    void *in_chunk = &((*chunk)[offset]);
-    size_t amount_in_chunk = CHUNK_SIZE - offset;
-    if (len <= amount_in_chunk) {
-      /* Everything fits in this chunk */
-      memcpy(in_chunk, buf, len);
-      break;
-    } else {
-      memcpy(in_chunk, buf, amount_in_chunk);
-      len -= amount_in_chunk;
-      buf += amount_in_chunk;
-    }
+  if (addr >= RAM_SIZE || len > RAM_SIZE - addr) {
+    fprintf(stderr, "ram_store: address %#llx out of range\n", (unsigned long long) addr);
+    return;
+  }
+  if (len == 0) {
+    return;
+  }
+  for (size_t idx = addr / CHUNK_SIZE; idx <= (addr + len - 1) / CHUNK_SIZE; idx++) {
+    touch_chunk(idx);
   }
+  memcpy((uint8_t *) chunks + addr, buf, len);
 }
 
 void ram_fetch(paddr_ptr addr, void *buf, size_t len) {
-  while (len) {
-    size_t chunk_idx = addr / CHUNK_SIZE;
-    chunk *chunk = get_chunk(chunk_idx);
-    size_t offset = addr % CHUNK_SIZE;
-    void *in_chunk = &((*chunk)[offset]);
-    size_t amount_in_chunk = CHUNK_SIZE - offset;
-    if (len <= amount_in_chunk) {
-      /* Everything fits in this chunk */
-      memcpy(buf, in_chunk, len);
-      break;
-    } else {
-      memcpy(buf, in_chunk, amount_in_chunk);
-      len -= amount_in_chunk;
-      buf += amount_in_chunk;
-    }
+  if (addr >= RAM_SIZE || len > RAM_SIZE - addr) {
+    fprintf(stderr, "ram_fetch: address %#llx out of range\n", (unsigned long long) addr);
+    memset(buf, 0, len);
+    return;
   }
+  memcpy(buf, (uint8_t *) chunks + addr, len);
 }
 
+/* Releases all of RAM and leaves it empty and ready for use again, as after
+   ram_init. */
 void ram_destroy(void) {
-  free(chunks);
+  if (chunks != NULL && chunks != MAP_FAILED) {
+    munmap(chunks, RAM_SIZE);
+  }
   ram_init();
 }
 
+/* Writes all of BUF[0..LEN) to FD. Returns false on error. */
+static bool write_all(int fd, const void *buf, size_t len) {
+  const uint8_t *p = buf;
+  while (len) {
+    ssize_t n = write(fd, p, len);
+    if (n <= 0) {
+      perror("ram_save: write");
+      return false;
+    }
+    p += n;
+    len -= n;
+  }
+  return true;
+}
+
+/* Saves the chunks in use to PATH. The image is written to PATH.tmp and then
+   renamed over PATH, because PATH may be the image ram_load mapped the chunks
+   from, and truncating it would pull the data out from under the mapping. */
 size_t ram_save(char *path) {
-  FILE *f = fopen(path, "wb");
-  size_t written = fwrite(chunk_table, sizeof(chunk_table), 1, f) * sizeof(chunk_table);
-  printf("Writing %lu chunks\n", num_chunks);
-  written += fwrite(chunks, sizeof(chunk), num_chunks, f) * sizeof(chunk);
+  size_t written = 0;
+  size_t saved = 0;
+  size_t tmp_len = strlen(path) + sizeof ".tmp";
+  char *tmp = malloc(tmp_len);
+  int32_t *table = malloc(sizeof(chunk_table));
+  int fd = -1;
+
+  if (tmp == NULL || table == NULL) {
+    perror("ram_save: malloc");
+    goto fail;
+  }
+  snprintf(tmp, tmp_len, "%s.tmp", path);
+  fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    perror("ram_save: open");
+    goto fail;
+  }
+
+  /* Number the chunks that exist densely, in address order, so that the file
+     holds exactly those chunks even if ram_load dropped some. */
+  for (size_t i = 0; i < MAX_CHUNKS; i++) {
+    table[i] = chunk_table[i] >= 0 ? (int32_t) saved++ : -1;
+  }
+
+  if (!write_all(fd, table, sizeof(chunk_table))) {
+    goto fail;
+  }
+  written += sizeof(chunk_table);
+  printf("Writing %lu chunks\n", saved);
+  for (size_t i = 0; i < MAX_CHUNKS; i++) {
+    if (table[i] >= 0) {
+      if (!write_all(fd, &chunks[i], sizeof(chunk))) {
+        goto fail;
+      }
+      written += sizeof(chunk);
+    }
+  }
+  if (close(fd) < 0) {
+    perror("ram_save: close");
+    fd = -1;
+    goto fail;
+  }
+  fd = -1;
+  if (rename(tmp, path) < 0) {
+    perror("ram_save: rename");
+    goto fail;
+  }
   printf("Wrote %lu bytes to file\n", written);
-  fclose(f);
+  free(table);
+  free(tmp);
   return written;
+
+fail:
+  if (fd >= 0) {
+    close(fd);
+  }
+  if (tmp != NULL) {
+    unlink(tmp);
+  }
+  free(table);
+  free(tmp);
+  return 0;
 }
 
 size_t ram_load(char *path) {
-  FILE *f = fopen(path, "rb");
-  size_t read = fread(chunk_table, sizeof(chunk_table), 1, f);
-  while (!feof(f)) {
-    chunks = realloc(chunks, ++num_chunks * CHUNK_SIZE);
-    read += fread(&chunks[num_chunks - 1], sizeof(chunk), 1, f);
-  }
-  printf("Read bytes: %lu from file\n", read);
-  fclose(f);
-  return read;
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    perror("ram_load: open");
+    return 0;
+  }
+
+  struct stat st;
+  size_t read_bytes = 0;
+  if (fstat(fd, &st) < 0 || (size_t) st.st_size < sizeof(chunk_table)) {
+    fprintf(stderr, "ram_load: %s is not a memory image\n", path);
+    close(fd);
+    return 0;
+  }
+
+  if (read(fd, chunk_table, sizeof(chunk_table)) != sizeof(chunk_table)) {
+    perror("ram_load: read");
+    close(fd);
+    return 0;
+  }
+  read_bytes += sizeof(chunk_table);
+
+  /* Map each saved chunk copy-on-write over its slot in the reserved range.
+     Pages are then faulted in from the page cache only when accessed, and
+     later stores never modify the image. */
+  num_chunks = 0;
+  for (size_t i = 0; i < MAX_CHUNKS; i++) {
+    int32_t entry = chunk_table[i];
+    if (entry < 0) {
+      continue;
+    }
+    off_t offset = sizeof(chunk_table) + (off_t) entry * CHUNK_SIZE;
+    if (offset + (off_t) CHUNK_SIZE > st.st_size) {
+      fprintf(stderr, "ram_load: chunk %zu missing from %s\n", i, path);
+      chunk_table[i] = -1;
+      continue;
+    }
+    void *slot = mmap(&chunks[i], CHUNK_SIZE, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_FIXED, fd, offset);
+    if (slot == MAP_FAILED) {
+      perror("ram_load: mmap");
+      chunk_table[i] = -1;
+      continue;
+    }
+    if ((size_t) entry >= num_chunks) {
+      num_chunks = entry + 1;
+    }
+    read_bytes += CHUNK_SIZE;
+  }
+
+  printf("Read bytes: %lu from file\n", read_bytes);
+  close(fd);
+  return read_bytes;
 }
@@ -4,8 +4,17 @@
 #include <stdio.h>
 #include "devices/ide.h"
 #include "threads/malloc.h"
+#include "threads/synch.h"
 
-/* A block device. */
+/* A block device.
+
+   Reads and writes are queued per device.  Whichever thread
+   finds the device idle issues queued requests to the driver
+   until its own is done, while other threads wait and add to the
+   queue.  Requests are issued in C-LOOK order: the lowest sector
+   at or after the end of the last request, wrapping around to
+   the lowest sector overall.  Queued requests in the same
+   direction that continue the chosen one are merged into it. */
 struct block
   {
     struct list_elem list_elem;         /* Element in all_blocks. */
@@ -19,6 +28,25 @@ struct block
 
     unsigned long long read_cnt;        /* Number of sectors read. */
     unsigned long long write_cnt;       /* Number of sectors written. */
+    unsigned long long issue_cnt;       /* Requests issued to the driver. */
+    unsigned long long merge_cnt;       /* Requests merged into others. */
+
+    struct lock queue_lock;             /* Protects the members below. */
+    struct condition queue_done;        /* Signaled when requests finish. */
+    struct list queue;                  /* Pending struct requests. */
+    bool busy;                          /* Some thread is issuing requests. */
+    block_sector_t head;                /* Sector after the last request. */
+  };
+
+/* A read or write waiting in a block device's queue. */
+struct request
+  {
+    struct list_elem elem;              /* Element in queue. */
+    block_sector_t sector;              /* First sector. */
+    size_t cnt;                         /* Number of sectors. */
+    void *buffer;                       /* CNT sectors (const for writes). */
+    bool write;                         /* Write or read? */
+    bool done;                          /* Completed? */
   };
 
 /* List of all block devices. */
@@ -113,6 +141,175 @@ check_sector (struct block *block, block_sector_t sector)
     }
 }
 
+/* Returns the request in BLOCK's queue to issue next, in C-LOOK
+   order.  The queue must not be empty. */
+static struct request *
+next_request (struct block *block)
+{
+  struct request *ahead = NULL, *lowest = NULL;
+  struct list_elem *e;
+
+  for (e = list_begin (&block->queue); e != list_end (&block->queue);
+       e = list_next (e))
+    {
+      struct request *r = list_entry (e, struct request, elem);
+      if (r->sector >= block->head
+          && (ahead == NULL || r->sector < ahead->sector))
+        ahead = r;
+      if (lowest == NULL || r->sector < lowest->sector)
+        lowest = r;
+    }
+  return ahead != NULL ? ahead : lowest;
+}
+
+/* Removes and returns a request from BLOCK's queue that can be
+   appended to a WRITE request ending at sector END that already
+   covers CNT sectors, or returns a null pointer. */
+static struct request *
+take_mergeable (struct block *block, bool write, block_sector_t end,
+                size_t cnt)
+{
+  struct list_elem *e;
+
+  for (e = list_begin (&block->queue); e != list_end (&block->queue);
+       e = list_next (e))
+    {
+      struct request *r = list_entry (e, struct request, elem);
+      if (r->write == write && r->sector == end
+          && cnt + r->cnt <= BLOCK_MAX_TRANSFER)
+        {
+          list_remove (e);
+          return r;
+        }
+    }
+  return NULL;
+}
+
+/* Passes the CNT sectors starting at SECTOR of the requests in
+   BATCH to BLOCK's driver. */
+static void
+transfer (struct block *block, struct list *batch, block_sector_t sector,
+          size_t cnt, bool write)
+{
+  void *buffers[BLOCK_MAX_TRANSFER];
+  struct list_elem *e;
+  size_t i = 0;
+
+  for (e = list_begin (batch); e != list_end (batch); e = list_next (e))
+    {
+      struct request *r = list_entry (e, struct request, elem);
+      size_t j;
+
+      for (j = 0; j < r->cnt; j++)
+        buffers[i++] = (uint8_t *) r->buffer + j * BLOCK_SECTOR_SIZE;
+    }
+  ASSERT (i == cnt);
+
+  if (write && block->ops->write_multiple != NULL)
+    block->ops->write_multiple (block->aux, sector, cnt,
+                                (const void **) buffers);
+  else if (!write && block->ops->read_multiple != NULL)
+    block->ops->read_multiple (block->aux, sector, cnt, buffers);
+  else
+    for (i = 0; i < cnt; i++)
+      if (write)
+        block->ops->write (block->aux, sector + i, buffers[i]);
+      else
+        block->ops->read (block->aux, sector + i, buffers[i]);
+}
+
+/* Issues the next request in BLOCK's queue, merged with any
+   queued requests that continue it.  BLOCK's queue lock must be
+   held; it is released while the driver runs. */
+static void
+issue_next (struct block *block)
+{
+  struct request *first = next_request (block);
+  struct request *r;
+  struct list batch;
+  block_sector_t end;
+  size_t cnt, merged = 0;
+
+  list_remove (&first->elem);
+  list_init (&batch);
+  list_push_back (&batch, &first->elem);
+  end = first->sector + first->cnt;
+  cnt = first->cnt;
+  while ((r = take_mergeable (block, first->write, end, cnt)) != NULL)
+    {
+      list_push_back (&batch, &r->elem);
+      end += r->cnt;
+      cnt += r->cnt;
+      merged++;
+    }
+
+  lock_release (&block->queue_lock);
+  transfer (block, &batch, first->sector, cnt, first->write);
+  lock_acquire (&block->queue_lock);
+
+  while (!list_empty (&batch))
+    list_entry (list_pop_front (&batch), struct request, elem)->done = true;
+  if (first->write)
+    block->write_cnt += cnt;
+  else
+    block->read_cnt += cnt;
+  block->issue_cnt++;
+  block->merge_cnt += merged;
+  block->head = end;
+  cond_broadcast (&block->queue_done, &block->queue_lock);
+}
+
+/* Queues a request to transfer CNT sectors starting at SECTOR in
+   BLOCK to or from BUFFER, and waits until it completes. */
+static void
+submit (struct block *block, block_sector_t sector, size_t cnt,
+        void *buffer, bool write)
+{
+  struct request r;
+
+  ASSERT (cnt > 0 && cnt <= BLOCK_MAX_TRANSFER);
+
+  r.sector = sector;
+  r.cnt = cnt;
+  r.buffer = buffer;
+  r.write = write;
+  r.done = false;
+
+  lock_acquire (&block->queue_lock);
+  list_push_back (&block->queue, &r.elem);
+  while (!r.done && block->busy)
+    cond_wait (&block->queue_done, &block->queue_lock);
+  if (!r.done)
+    {
+      block->busy = true;
+      while (!r.done)
+        issue_next (block);
+      block->busy = false;
+      cond_broadcast (&block->queue_done, &block->queue_lock);
+    }
+  lock_release (&block->queue_lock);
+}
+
+/* Transfers CNT sectors starting at SECTOR in BLOCK to or from
+   BUFFER, in requests of at most BLOCK_MAX_TRANSFER sectors. */
+static void
+submit_multiple (struct block *block, block_sector_t sector, size_t cnt,
+                 void *buffer, bool write)
+{
+  if (cnt == 0)
+    return;
+  check_sector (block, sector);
+  check_sector (block, sector + cnt - 1);
+  while (cnt > 0)
+    {
+      size_t n = cnt < BLOCK_MAX_TRANSFER ? cnt : BLOCK_MAX_TRANSFER;
+      submit (block, sector, n, buffer, write);
+      sector += n;
+      cnt -= n;
+      buffer = (uint8_t *) buffer + n * BLOCK_SECTOR_SIZE;
+    }
+}
+
 /* Reads sector SECTOR from BLOCK into BUFFER, which must
    have room for BLOCK_SECTOR_SIZE bytes.
    Internally synchronizes accesses to block devices, so external
@@ -120,9 +317,7 @@ check_sector (struct block *block, block_sector_t sector)
 void
 block_read (struct block *block, block_sector_t sector, void *buffer)
 {
-  check_sector (block, sector);
-  block->ops->read (block->aux, sector, buffer);
-  block->read_cnt++;
+  submit_multiple (block, sector, 1, buffer, false);
 }
 
 /* Write sector SECTOR to BLOCK from BUFFER, which must contain
@@ -133,10 +328,29 @@ block_read (struct block *block, block_sector_t sector, void *buffer)
 void
 block_write (struct block *block, block_sector_t sector, const void *buffer)
 {
-  check_sector (block, sector);
   ASSERT (block->type != BLOCK_FOREIGN);
-  block->ops->write (block->aux, sector, buffer);
-  block->write_cnt++;
+  submit_multiple (block, sector, 1, (void *) buffer, true);
+}
+
+/* Reads CNT consecutive sectors starting at SECTOR from BLOCK
+   into BUFFER, which must have room for CNT * BLOCK_SECTOR_SIZE
+   bytes.  Synchronizes like block_read(). */
+void
+block_read_multiple (struct block *block, block_sector_t sector, size_t cnt,
+                     void *buffer)
+{
+  submit_multiple (block, sector, cnt, buffer, false);
+}
+
+/* Writes CNT consecutive sectors starting at SECTOR to BLOCK from
+   BUFFER, which must contain CNT * BLOCK_SECTOR_SIZE bytes.
+   Synchronizes like block_write(). */
+void
+block_write_multiple (struct block *block, block_sector_t sector,
+                      size_t cnt, const void *buffer)
+{
+  ASSERT (block->type != BLOCK_FOREIGN);
+  submit_multiple (block, sector, cnt, (void *) buffer, true);
 }
 
 /* Returns the number of sectors in BLOCK. */
@@ -171,9 +385,11 @@ block_print_stats (void)
       struct block *block = block_by_role[i];
       if (block != NULL)
         {
-          printf ("%s (%s): %llu reads, %llu writes\n",
+          printf ("%s (%s): %llu reads, %llu writes, "
+                  "%llu requests issued, %llu merged\n",
                   block->name, block_type_name (block->type),
-                  block->read_cnt, block->write_cnt);
+                  block->read_cnt, block->write_cnt,
+                  block->issue_cnt, block->merge_cnt);
         }
     }
 }
@@ -200,6 +416,13 @@ block_register (const char *name, enum block_type type,
   block->aux = aux;
   block->read_cnt = 0;
   block->write_cnt = 0;
+  block->issue_cnt = 0;
+  block->merge_cnt = 0;
+  lock_init (&block->queue_lock);
+  cond_init (&block->queue_done);
+  list_init (&block->queue);
+  block->busy = false;
+  block->head = 0;
 
   printf ("%s: %'"PRDSNu" sectors (", block->name, block->size);
   print_human_readable_size ((uint64_t) block->size * BLOCK_SECTOR_SIZE);
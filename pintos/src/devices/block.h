@@ -14,6 +14,10 @@
    Good enough for devices up to 2 TB. */
 typedef uint32_t block_sector_t;
 
+/* Maximum number of sectors the block layer passes to a driver
+   in one request. */
+#define BLOCK_MAX_TRANSFER 64
+
 /* Format specifier for printf(), e.g.:
    printf ("sector=%"PRDSNu"\n", sector); */
 #define PRDSNu PRIu32
@@ -53,6 +57,10 @@ struct block *block_next (struct block *);
 block_sector_t block_size (struct block *);
 void block_read (struct block *, block_sector_t, void *);
 void block_write (struct block *, block_sector_t, const void *);
+void block_read_multiple (struct block *, block_sector_t, size_t cnt,
+                          void *);
+void block_write_multiple (struct block *, block_sector_t, size_t cnt,
+                           const void *);
 const char *block_name (struct block *);
 enum block_type block_type (struct block *);
 
@@ -65,6 +73,13 @@ struct block_operations
   {
     void (*read) (void *aux, block_sector_t, void *buffer);
     void (*write) (void *aux, block_sector_t, const void *buffer);
+
+    /* Optional.  Transfer CNT consecutive sectors, at most
+       BLOCK_MAX_TRANSFER, of which the Ith is in BUFFERS[I]. */
+    void (*read_multiple) (void *aux, block_sector_t, size_t cnt,
+                           void *buffers[]);
+    void (*write_multiple) (void *aux, block_sector_t, size_t cnt,
+                            const void *buffers[]);
   };
 
 struct block *block_register (const char *name, enum block_type,
@@ -8,7 +8,9 @@
 #include "devices/timer.h"
 #include "threads/io.h"
 #include "threads/interrupt.h"
+#include "threads/palloc.h"
 #include "threads/synch.h"
+#include "threads/vaddr.h"
 
 /* The code in this file is an interface to an ATA (IDE)
    controller.  It attempts to comply to [ATA-3]. */
@@ -34,6 +36,7 @@
 #define STA_BSY 0x80            /* Busy. */
 #define STA_DRDY 0x40           /* Device Ready. */
 #define STA_DRQ 0x08            /* Data Request. */
+#define STA_ERR 0x01            /* Error. */
 
 /* Control Register bits. */
 #define CTL_SRST 0x04           /* Software Reset. */
@@ -49,6 +52,39 @@
 #define CMD_IDENTIFY_DEVICE 0xec        /* IDENTIFY DEVICE. */
 #define CMD_READ_SECTOR_RETRY 0x20      /* READ SECTOR with retries. */
 #define CMD_WRITE_SECTOR_RETRY 0x30     /* WRITE SECTOR with retries. */
+#define CMD_READ_MULTIPLE 0xc4          /* READ MULTIPLE. */
+#define CMD_WRITE_MULTIPLE 0xc5         /* WRITE MULTIPLE. */
+#define CMD_SET_MULTIPLE_MODE 0xc6      /* SET MULTIPLE MODE. */
+#define CMD_READ_DMA 0xc8               /* READ DMA. */
+#define CMD_WRITE_DMA 0xca              /* WRITE DMA. */
+
+/* Bus master IDE port addresses.
+   Each channel has its own 8-byte block of them. */
+#define reg_bm_command(CHANNEL) ((CHANNEL)->bm_base + 0) /* Command. */
+#define reg_bm_status(CHANNEL) ((CHANNEL)->bm_base + 2)  /* Status. */
+#define reg_bm_prdt(CHANNEL) ((CHANNEL)->bm_base + 4)    /* PRD table. */
+
+/* Bus master Command Register bits. */
+#define BM_START 0x01           /* Start transfer. */
+#define BM_READ 0x08            /* Transfer from device to memory. */
+
+/* Bus master Status Register bits.  Written as 1 to clear. */
+#define BM_ERR 0x02             /* Error. */
+#define BM_IRQ 0x04             /* Interrupt. */
+
+/* A physical region descriptor, one entry in the table that
+   tells the bus master where in physical memory to transfer.
+   A region may not cross a 64 kB boundary; a size of 0 means
+   64 kB. */
+struct prd
+  {
+    uint32_t addr;              /* Physical address. */
+    uint16_t size;              /* Size in bytes. */
+    uint16_t flags;             /* PRD_EOT on the last entry. */
+  };
+
+#define PRD_EOT 0x8000          /* End of table. */
+#define PRD_CNT (PGSIZE / sizeof (struct prd))  /* Entries per table. */
 
 /* An ATA device. */
 struct ata_disk
@@ -57,6 +93,9 @@ struct ata_disk
     struct channel *channel;    /* Channel that disk is attached to. */
     int dev_no;                 /* Device 0 or 1 for master or slave. */
     bool is_ata;                /* Is device an ATA disk? */
+    int multiple;               /* Sectors per interrupt in READ/WRITE
+                                   MULTIPLE, or 0 if not in use. */
+    bool dma;                   /* Transfer by bus master DMA? */
   };
 
 /* An ATA channel (aka controller).
@@ -66,6 +105,8 @@ struct channel
     char name[8];               /* Name, e.g. "ide0". */
     uint16_t reg_base;          /* Base I/O port. */
     uint8_t irq;                /* Interrupt in use. */
+    uint16_t bm_base;           /* Bus master I/O port, if any. */
+    struct prd *prdt;           /* PRD table, or null if no bus master. */
 
     struct lock lock;           /* Must acquire to access the controller. */
     bool expecting_interrupt;   /* True if an interrupt is expected, false if
@@ -85,8 +126,10 @@ static void reset_channel (struct channel *);
 static bool check_device_type (struct ata_disk *);
 static void identify_ata_device (struct ata_disk *);
 
-static void select_sector (struct ata_disk *, block_sector_t);
+static void select_sectors (struct ata_disk *, block_sector_t, size_t cnt);
 static void issue_pio_command (struct channel *, uint8_t command);
+static void dma_transfer (struct ata_disk *, block_sector_t, size_t cnt,
+                          const void *buffers[], bool read);
 static void input_sector (struct channel *, void *);
 static void output_sector (struct channel *, const void *);
 
@@ -97,10 +140,13 @@ static void select_device_wait (const struct ata_disk *);
 
 static void interrupt_handler (struct intr_frame *);
 
+static uint16_t find_bus_master (void);
+
 /* Initialize the disk subsystem and detect disks. */
 void
 ide_init (void)
 {
+  uint16_t bm_base = find_bus_master ();
   size_t chan_no;
 
   for (chan_no = 0; chan_no < CHANNEL_CNT; chan_no++)
@@ -127,6 +173,10 @@ ide_init (void)
       c->expecting_interrupt = false;
       sema_init (&c->completion_wait, 0);
 
+      /* Use the controller's bus master, if it has one, for DMA. */
+      c->bm_base = bm_base != 0 ? bm_base + chan_no * 8 : 0;
+      c->prdt = c->bm_base != 0 ? palloc_get_page (0) : NULL;
+
       /* Initialize devices. */
       for (dev_no = 0; dev_no < 2; dev_no++)
         {
@@ -136,6 +186,8 @@ ide_init (void)
           d->channel = c;
           d->dev_no = dev_no;
           d->is_ata = false;
+          d->multiple = 0;
+          d->dma = false;
         }
 
       /* Register interrupt handler. */
@@ -158,6 +210,7 @@ ide_init (void)
 /* Disk detection and identification. */
 
 static char *descramble_ata_string (char *, int size);
+static void set_multiple_mode (struct ata_disk *, int max);
 
 /* Resets an ATA channel and waits for any devices present on it
    to finish the reset. */
@@ -303,12 +356,43 @@ identify_ata_device (struct ata_disk *d)
       return;
     }
 
+  /* Transfer as many sectors per interrupt as the disk allows. */
+  set_multiple_mode (d, id[47 * 2] & 0xff);
+
+  /* Transfer by DMA if both the controller and the disk can. */
+  d->dma = c->prdt != NULL && (id[49 * 2 + 1] & 0x01) != 0;
+
   /* Register. */
   block = block_register (d->name, BLOCK_RAW, extra_info, capacity,
                           &ide_operations, d);
   partition_scan (block);
 }
 
+/* Enables READ MULTIPLE and WRITE MULTIPLE on disk D with the
+   largest power of 2 sectors per interrupt that is at most MAX,
+   the limit the disk reported in its identity information.
+   Leaves them disabled if MAX is less than 2 or the disk refuses. */
+static void
+set_multiple_mode (struct ata_disk *d, int max)
+{
+  struct channel *c = d->channel;
+  int cnt;
+
+  d->multiple = 0;
+  if (max < 2)
+    return;
+  for (cnt = 2; cnt * 2 <= max; cnt *= 2)
+    continue;
+
+  select_device_wait (d);
+  outb (reg_nsect (c), cnt);
+  issue_pio_command (c, CMD_SET_MULTIPLE_MODE);
+  sema_down (&c->completion_wait);
+  wait_while_busy (d);
+  if ((inb (reg_alt_status (c)) & STA_ERR) == 0)
+    d->multiple = cnt;
+}
+
 /* Translates STRING, which consists of SIZE bytes in a funky
    format, into a null-terminated string in-place.  Drops
    trailing whitespace and null bytes.  Returns STRING.  */
@@ -337,63 +421,120 @@ descramble_ata_string (char *string, int size)
   return string;
 }
 
-/* Reads sector SEC_NO from disk D into BUFFER, which must have
-   room for BLOCK_SECTOR_SIZE bytes.
+/* Reads CNT sectors starting at SEC_NO from disk D, the Ith into
+   BUFFERS[I], each of which must have room for BLOCK_SECTOR_SIZE
+   bytes.  Uses DMA if D supports it, so that the whole transfer
+   completes with a single interrupt and no work by the CPU.
+   Otherwise, uses READ MULTIPLE if it is enabled, so that the disk
+   interrupts once per D->multiple sectors instead of once per
+   sector.
    Internally synchronizes accesses to disks, so external
    per-disk locking is unneeded. */
 static void
-ide_read (void *d_, block_sector_t sec_no, void *buffer)
+ide_read_multiple (void *d_, block_sector_t sec_no, size_t cnt,
+                   void *buffers[])
 {
   struct ata_disk *d = d_;
   struct channel *c = d->channel;
+  size_t per_irq = d->multiple > 1 ? d->multiple : 1;
+  size_t i, j;
+
   lock_acquire (&c->lock);
-  select_sector (d, sec_no);
-  issue_pio_command (c, CMD_READ_SECTOR_RETRY);
-  sema_down (&c->completion_wait);
-  if (!wait_while_busy (d))
-    PANIC ("%s: disk read failed, sector=%"PRDSNu, d->name, sec_no);
-  input_sector (c, buffer);
+  if (d->dma)
+    dma_transfer (d, sec_no, cnt, (const void **) buffers, true);
+  else
+    {
+      select_sectors (d, sec_no, cnt);
+      issue_pio_command (c, d->multiple > 1 ? CMD_READ_MULTIPLE
+                                            : CMD_READ_SECTOR_RETRY);
+      for (i = 0; i < cnt; i += per_irq)
+        {
+          sema_down (&c->completion_wait);
+          if (!wait_while_busy (d))
+            PANIC ("%s: disk read failed, sector=%"PRDSNu,
+                   d->name, sec_no + i);
+          for (j = i; j < cnt && j < i + per_irq; j++)
+            input_sector (c, buffers[j]);
+        }
+    }
   lock_release (&c->lock);
 }
 
-/* Write sector SEC_NO to disk D from BUFFER, which must contain
-   BLOCK_SECTOR_SIZE bytes.  Returns after the disk has
-   acknowledged receiving the data.
+/* Writes CNT sectors starting at SEC_NO to disk D, the Ith from
+   BUFFERS[I], each of which must contain BLOCK_SECTOR_SIZE bytes.
+   Uses DMA if D supports it, otherwise WRITE MULTIPLE if it is
+   enabled.  Returns after the disk
+   has acknowledged receiving the data.
    Internally synchronizes accesses to disks, so external
    per-disk locking is unneeded. */
 static void
-ide_write (void *d_, block_sector_t sec_no, const void *buffer)
+ide_write_multiple (void *d_, block_sector_t sec_no, size_t cnt,
+                    const void *buffers[])
 {
   struct ata_disk *d = d_;
   struct channel *c = d->channel;
+  size_t per_irq = d->multiple > 1 ? d->multiple : 1;
+  size_t i, j;
+
   lock_acquire (&c->lock);
-  select_sector (d, sec_no);
-  issue_pio_command (c, CMD_WRITE_SECTOR_RETRY);
-  if (!wait_while_busy (d))
-    PANIC ("%s: disk write failed, sector=%"PRDSNu, d->name, sec_no);
-  output_sector (c, buffer);
-  sema_down (&c->completion_wait);
+  if (d->dma)
+    dma_transfer (d, sec_no, cnt, buffers, false);
+  else
+    {
+      select_sectors (d, sec_no, cnt);
+      issue_pio_command (c, d->multiple > 1 ? CMD_WRITE_MULTIPLE
+                                            : CMD_WRITE_SECTOR_RETRY);
+      for (i = 0; i < cnt; i += per_irq)
+        {
+          if (!wait_while_busy (d))
+            PANIC ("%s: disk write failed, sector=%"PRDSNu,
+                   d->name, sec_no + i);
+          for (j = i; j < cnt && j < i + per_irq; j++)
+            output_sector (c, buffers[j]);
+          sema_down (&c->completion_wait);
+        }
+    }
   lock_release (&c->lock);
 }
 
+/* Reads sector SEC_NO from disk D into BUFFER, which must have
+   room for BLOCK_SECTOR_SIZE bytes. */
+static void
+ide_read (void *d_, block_sector_t sec_no, void *buffer)
+{
+  ide_read_multiple (d_, sec_no, 1, &buffer);
+}
+
+/* Write sector SEC_NO to disk D from BUFFER, which must contain
+   BLOCK_SECTOR_SIZE bytes.  Returns after the disk has
+   acknowledged receiving the data. */
+static void
+ide_write (void *d_, block_sector_t sec_no, const void *buffer)
+{
+  ide_write_multiple (d_, sec_no, 1, &buffer);
+}
+
 static struct block_operations ide_operations =
   {
     ide_read,
-    ide_write
+    ide_write,
+    ide_read_multiple,
+    ide_write_multiple
   };
 
 /* Selects device D, waiting for it to become ready, and then
-   writes SEC_NO to the disk's sector selection registers.  (We
-   use LBA mode.) */
+   writes SEC_NO and CNT to the disk's sector selection and
+   sector count registers.  (We use LBA mode.) */
 static void
-select_sector (struct ata_disk *d, block_sector_t sec_no)
+select_sectors (struct ata_disk *d, block_sector_t sec_no, size_t cnt)
 {
   struct channel *c = d->channel;
 
   ASSERT (sec_no < (1UL << 28));
+  ASSERT (cnt > 0 && cnt <= 256);
 
   select_device_wait (d);
-  outb (reg_nsect (c), 1);
+  outb (reg_nsect (c), cnt == 256 ? 0 : cnt);
   outb (reg_lbal (c), sec_no);
   outb (reg_lbam (c), sec_no >> 8);
   outb (reg_lbah (c), (sec_no >> 16));
@@ -430,6 +571,157 @@ output_sector (struct channel *c, const void *sector)
   outsw (reg_data (c), sector, BLOCK_SECTOR_SIZE / 2);
 }
 
+/* Bus master DMA. */
+
+/* PCI configuration space ports. */
+#define PCI_CONFIG_ADDR 0xcf8
+#define PCI_CONFIG_DATA 0xcfc
+
+/* Returns the 32-bit PCI configuration register at offset REG
+   of function FUNC of device DEV on bus 0. */
+static uint32_t
+pci_read_config (int dev, int func, int reg)
+{
+  outl (PCI_CONFIG_ADDR, 0x80000000 | (dev << 11) | (func << 8) | reg);
+  return inl (PCI_CONFIG_DATA);
+}
+
+/* Writes VALUE to the 32-bit PCI configuration register at
+   offset REG of function FUNC of device DEV on bus 0. */
+static void
+pci_write_config (int dev, int func, int reg, uint32_t value)
+{
+  outl (PCI_CONFIG_ADDR, 0x80000000 | (dev << 11) | (func << 8) | reg);
+  outl (PCI_CONFIG_DATA, value);
+}
+
+/* Looks on PCI bus 0 for an IDE controller, such as the PIIX,
+   that runs both channels at the legacy ports we use and can act
+   as a bus master.  If there is one, enables bus mastering and
+   returns the base of its bus master I/O ports.  Otherwise,
+   returns 0, and all transfers are done by PIO. */
+static uint16_t
+find_bus_master (void)
+{
+  int dev, func;
+
+  for (dev = 0; dev < 32; dev++)
+    for (func = 0; func < 8; func++)
+      {
+        uint32_t id = pci_read_config (dev, func, 0x00);
+        uint32_t class, bar4, command;
+
+        if ((id & 0xffff) == 0xffff)
+          {
+            /* No such function.  A device without function 0 has
+               no others. */
+            if (func == 0)
+              break;
+            continue;
+          }
+
+        /* Class 01 (mass storage), subclass 01 (IDE), with
+           programming interface bits saying both channels are in
+           compatibility mode (0 and 2 clear) and bus mastering is
+           supported (7 set). */
+        class = pci_read_config (dev, func, 0x08);
+        if ((class >> 16) != 0x0101 || (class & 0x8500) != 0x8000)
+          continue;
+
+        /* BAR4 holds the bus master ports, in I/O space. */
+        bar4 = pci_read_config (dev, func, 0x20);
+        if ((bar4 & 1) == 0 || (bar4 & 0xfffc) == 0)
+          continue;
+
+        /* Enable I/O space and bus master access.  Writing the
+           status half of the register as zeros leaves it alone. */
+        command = pci_read_config (dev, func, 0x04) & 0xffff;
+        pci_write_config (dev, func, 0x04, command | 0x05);
+
+        return bar4 & 0xfffc;
+      }
+  return 0;
+}
+
+/* Fills in channel C's PRD table to transfer CNT sectors to or
+   from BUFFERS.  Physically adjacent buffers share an entry, and
+   a buffer that straddles a 64 kB boundary takes two. */
+static void
+build_prdt (struct channel *c, const void *buffers[], size_t cnt)
+{
+  size_t n = 0;
+  size_t i;
+
+  for (i = 0; i < cnt; i++)
+    {
+      uintptr_t phys = vtop (buffers[i]);
+      size_t left = BLOCK_SECTOR_SIZE;
+
+      while (left > 0)
+        {
+          size_t size = 0x10000 - (phys & 0xffff);
+          if (size > left)
+            size = left;
+
+          /* An entry that grows to end exactly at a 64 kB boundary
+             wraps its size to 0, which means 64 kB, and is never
+             extended further because PHYS is then on the boundary. */
+          if (n > 0 && (phys & 0xffff) != 0
+              && c->prdt[n - 1].addr + c->prdt[n - 1].size == phys)
+            c->prdt[n - 1].size += size;
+          else
+            {
+              ASSERT (n < PRD_CNT);
+              c->prdt[n].addr = phys;
+              c->prdt[n].size = size;
+              c->prdt[n].flags = 0;
+              n++;
+            }
+          phys += size;
+          left -= size;
+        }
+    }
+  c->prdt[n - 1].flags = PRD_EOT;
+}
+
+/* Transfers CNT sectors starting at SEC_NO between disk D and
+   BUFFERS by DMA, from disk to memory if READ is true, from
+   memory to disk otherwise.  The bus master moves the data while
+   we sleep until the single completion interrupt.  The caller
+   must hold D's channel lock. */
+static void
+dma_transfer (struct ata_disk *d, block_sector_t sec_no, size_t cnt,
+              const void *buffers[], bool read)
+{
+  struct channel *c = d->channel;
+  uint8_t direction = read ? BM_READ : 0;
+  uint8_t bm_status;
+
+  ASSERT (lock_held_by_current_thread (&c->lock));
+
+  build_prdt (c, buffers, cnt);
+  outl (reg_bm_prdt (c), vtop (c->prdt));
+  outb (reg_bm_command (c), direction);
+  outb (reg_bm_status (c), inb (reg_bm_status (c)) | BM_ERR | BM_IRQ);
+
+  select_sectors (d, sec_no, cnt);
+  issue_pio_command (c, read ? CMD_READ_DMA : CMD_WRITE_DMA);
+
+  /* Make sure the PRD table and the data to write are in memory
+     before the bus master starts reading them. */
+  barrier ();
+  outb (reg_bm_command (c), direction | BM_START);
+  sema_down (&c->completion_wait);
+  outb (reg_bm_command (c), direction);
+  barrier ();
+
+  bm_status = inb (reg_bm_status (c));
+  outb (reg_bm_status (c), bm_status | BM_ERR | BM_IRQ);
+  if ((bm_status & BM_ERR) != 0 || (inb (reg_alt_status (c)) & STA_ERR) != 0)
+    PANIC ("%s: disk %s failed, sector=%"PRDSNu,
+           d->name, read ? "read" : "write", sec_no);
+}
+
 /* Low-level ATA primitives. */
 
 /* Wait up to 10 seconds for the controller to become idle, that
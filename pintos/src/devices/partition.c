@@ -317,8 +317,49 @@ partition_write (void *p_, block_sector_t sector, const void *buffer)
   block_write (p->block, p->start + sector, buffer);
 }
 
+/* Reads CNT sectors starting at SECTOR from partition P into
+   BUFFERS, passing each run of buffers that are contiguous in
+   memory to the underlying device as one request. */
+static void
+partition_read_multiple (void *p_, block_sector_t sector, size_t cnt,
+                         void *buffers[])
+{
+  struct partition *p = p_;
+  size_t i, n;
+
+  for (i = 0; i < cnt; i += n)
+    {
+      for (n = 1; i + n < cnt; n++)
+        if (buffers[i + n]
+            != (uint8_t *) buffers[i] + n * BLOCK_SECTOR_SIZE)
+          break;
+      block_read_multiple (p->block, p->start + sector + i, n, buffers[i]);
+    }
+}
+
+/* Writes CNT sectors starting at SECTOR to partition P from
+   BUFFERS, like partition_read_multiple(). */
+static void
+partition_write_multiple (void *p_, block_sector_t sector, size_t cnt,
+                          const void *buffers[])
+{
+  struct partition *p = p_;
+  size_t i, n;
+
+  for (i = 0; i < cnt; i += n)
+    {
+      for (n = 1; i + n < cnt; n++)
+        if (buffers[i + n]
+            != (const uint8_t *) buffers[i] + n * BLOCK_SECTOR_SIZE)
+          break;
+      block_write_multiple (p->block, p->start + sector + i, n, buffers[i]);
+    }
+}
+
 static struct block_operations partition_operations =
   {
     partition_read,
-    partition_write
+    partition_write,
+    partition_read_multiple,
+    partition_write_multiple
   };
@@ -1,6 +1,7 @@
 #include "devices/timer.h"
 #include <debug.h>
 #include <inttypes.h>
+#include <list.h>
 #include <round.h>
 #include <stdio.h>
 #include "devices/pit.h"
@@ -20,11 +21,22 @@
 /* Number of timer ticks since OS booted. */
 static int64_t ticks;
 
+/* Sleeping threads, hashed by wake-up tick into a timer wheel:
+   a thread waking at tick T waits in slot T % SLEEP_WHEEL_SLOTS.
+   Going to sleep is O(1), and each tick only looks at the one
+   slot that may hold threads due then.  A slot can also hold
+   threads due whole turns of the wheel later, which stay put
+   until their own tick comes around.  Threads are linked through
+   their `elem' member.  Accessed only with interrupts off. */
+#define SLEEP_WHEEL_SLOTS 256
+static struct list sleep_wheel[SLEEP_WHEEL_SLOTS];
+
 /* Number of loops per timer tick.
    Initialized by timer_calibrate(). */
 static unsigned loops_per_tick;
 
 static intr_handler_func timer_interrupt;
+static void wake_sleepers (void);
 static bool too_many_loops (unsigned loops);
 static void busy_wait (int64_t loops);
 static void real_time_sleep (int64_t num, int32_t denom);
@@ -35,6 +47,11 @@ static void real_time_delay (int64_t num, int32_t denom);
 void
 timer_init (void)
 {
+  size_t i;
+
+  for (i = 0; i < SLEEP_WHEEL_SLOTS; i++)
+    list_init (&sleep_wheel[i]);
+
   pit_configure_channel (0, 2, TIMER_FREQ);
   intr_register_ext (0x20, timer_interrupt, "8254 Timer");
 }
@@ -85,15 +102,25 @@ timer_elapsed (int64_t then)
 }
 
 /* Sleeps for approximately TICKS timer ticks.  Interrupts must
-   be turned on. */
+   be turned on.
+
+   The thread blocks on the sleep wheel until timer_interrupt()
+   wakes it, so it takes no CPU time while it sleeps. */
 void
 timer_sleep (int64_t ticks)
 {
-  int64_t start = timer_ticks ();
+  struct thread *t = thread_current ();
+  enum intr_level old_level;
 
   ASSERT (intr_get_level () == INTR_ON);
-  while (timer_elapsed (start) < ticks)
-    thread_yield ();
+  if (ticks <= 0)
+    return;
+
+  old_level = intr_disable ();
+  t->wake_tick = timer_ticks () + ticks;
+  list_push_back (&sleep_wheel[t->wake_tick % SLEEP_WHEEL_SLOTS], &t->elem);
+  thread_block ();
+  intr_set_level (old_level);
 }
 
 /* Sleeps for approximately MS milliseconds.  Interrupts must be
@@ -171,9 +198,35 @@ static void
 timer_interrupt (struct intr_frame *args UNUSED)
 {
   ticks++;
+  wake_sleepers ();
   thread_tick ();
 }
 
+/* Unblocks the sleeping threads due at the current tick, and
+   preempts the running thread if one of them outranks it. */
+static void
+wake_sleepers (void)
+{
+  struct list *slot = &sleep_wheel[ticks % SLEEP_WHEEL_SLOTS];
+  struct list_elem *e = list_begin (slot);
+  bool woke = false;
+
+  while (e != list_end (slot))
+    {
+      struct thread *t = list_entry (e, struct thread, elem);
+      if (t->wake_tick <= ticks)
+        {
+          e = list_remove (e);
+          thread_unblock (t);
+          woke = true;
+        }
+      else
+        e = list_next (e);
+    }
+  if (woke)
+    thread_preempt ();
+}
+
 /* Returns true if LOOPS iterations waits for more than one timer
    tick, otherwise false. */
 static bool
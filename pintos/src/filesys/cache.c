@@ -0,0 +1,538 @@
+#include "filesys/cache.h"
+#include <debug.h>
+#include <stdio.h>
+#include <string.h>
+#include "devices/timer.h"
+#include "filesys/filesys.h"
+#include "filesys/journal.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+
+/* Number of sectors held in the cache. */
+#define CACHE_SIZE 64
+
+/* Maximum number of sectors waiting to be read ahead. */
+#define READ_AHEAD_QUEUE 16
+
+/* Maximum number of consecutive sectors cache_flush() writes in
+   one request. */
+#define FLUSH_RUN 16
+
+/* Timer ticks between write-behind flushes. */
+#define WRITE_BEHIND_TICKS (5 * TIMER_FREQ)
+
+/* A cached sector.
+
+   Which sector an entry holds, and whether it may be evicted,
+   is protected by cache_lock.  An entry is pinned while USERS is
+   nonzero, and a pinned entry is never evicted.  A HELD entry is
+   part of an uncommitted journal transaction: it is neither
+   evicted nor written back until it is released.  While an
+   EVICTING entry writes the dirty contents of OLD_SECTOR back,
+   without cache_lock, anyone looking for OLD_SECTOR waits for it
+   to finish.  The sector data
+   and the DIRTY flag are protected by the entry's own
+   reader/writer lock: any number of readers, or one writer. */
+struct cache_entry
+  {
+    block_sector_t sector;              /* Sector held, if valid. */
+    bool valid;                         /* Holds a sector? */
+    bool accessed;                      /* Used since the clock hand passed? */
+    int users;                          /* Pin count. */
+    bool held;                          /* Kept off disk for now? */
+    bool evicting;                      /* Writing OLD_SECTOR back? */
+    block_sector_t old_sector;          /* Sector being written back. */
+
+    struct lock lock;                   /* Protects the fields below. */
+    struct condition cond;              /* Signaled when released. */
+    int readers;                        /* Number of readers. */
+    bool writer;                        /* Held by a writer? */
+
+    bool dirty;                         /* Modified since read or written? */
+    uint8_t data[BLOCK_SECTOR_SIZE];    /* Sector contents. */
+  };
+
+static struct cache_entry cache[CACHE_SIZE];
+static struct lock cache_lock;
+static struct condition cache_unpinned; /* Signaled when USERS drops to 0. */
+static struct condition cache_evicted;  /* Signaled when EVICTING clears. */
+static size_t clock_hand;
+
+/* Sectors queued for the read-ahead thread, in a ring buffer.
+   When the ring is full, further requests are dropped. */
+static block_sector_t read_ahead_queue[READ_AHEAD_QUEUE];
+static size_t read_ahead_head, read_ahead_cnt;
+static struct lock read_ahead_lock;
+static struct condition read_ahead_ready;
+
+/* Serializes cache_flush() and holds the sectors it writes. */
+static struct lock flush_lock;
+static uint8_t flush_buffer[FLUSH_RUN * BLOCK_SECTOR_SIZE];
+
+/* Statistics. */
+static long long hit_cnt, miss_cnt;
+
+static thread_func read_ahead_thread;
+static thread_func write_behind_thread;
+
+/* Initializes the buffer cache. */
+void
+cache_init (void)
+{
+  size_t i;
+
+  lock_init (&cache_lock);
+  cond_init (&cache_unpinned);
+  cond_init (&cache_evicted);
+  for (i = 0; i < CACHE_SIZE; i++)
+    {
+      struct cache_entry *e = &cache[i];
+      e->valid = false;
+      e->users = 0;
+      e->held = false;
+      e->evicting = false;
+      lock_init (&e->lock);
+      cond_init (&e->cond);
+      e->readers = 0;
+      e->writer = false;
+    }
+
+  lock_init (&flush_lock);
+  lock_init (&read_ahead_lock);
+  cond_init (&read_ahead_ready);
+  thread_create ("read-ahead", PRI_DEFAULT, read_ahead_thread, NULL);
+  thread_create ("write-behind", PRI_DEFAULT, write_behind_thread, NULL);
+}
+
+/* Acquires E for reading or, if EXCLUSIVE, for writing. */
+static void
+entry_acquire (struct cache_entry *e, bool exclusive)
+{
+  lock_acquire (&e->lock);
+  while (e->writer || (exclusive && e->readers > 0))
+    cond_wait (&e->cond, &e->lock);
+  if (exclusive)
+    e->writer = true;
+  else
+    e->readers++;
+  lock_release (&e->lock);
+}
+
+/* Releases E, which the caller acquired with entry_acquire(). */
+static void
+entry_release (struct cache_entry *e)
+{
+  lock_acquire (&e->lock);
+  if (e->writer)
+    e->writer = false;
+  else
+    e->readers--;
+  cond_broadcast (&e->cond, &e->lock);
+  lock_release (&e->lock);
+}
+
+/* Returns the entry holding SECTOR, or a null pointer.
+   The caller must hold cache_lock. */
+static struct cache_entry *
+lookup (block_sector_t sector)
+{
+  size_t i;
+
+  for (i = 0; i < CACHE_SIZE; i++)
+    if (cache[i].valid && cache[i].sector == sector)
+      return &cache[i];
+  return NULL;
+}
+
+/* Returns true if an entry is writing SECTOR back to disk.  The
+   caller must hold cache_lock. */
+static bool
+being_evicted (block_sector_t sector)
+{
+  size_t i;
+
+  for (i = 0; i < CACHE_SIZE; i++)
+    if (cache[i].evicting && cache[i].old_sector == sector)
+      return true;
+  return false;
+}
+
+/* Picks an unpinned entry to reuse with the clock algorithm,
+   preferring empty entries, or returns a null pointer if every
+   entry is pinned.  The caller must hold cache_lock. */
+static struct cache_entry *
+choose_victim (void)
+{
+  size_t i;
+
+  for (i = 0; i < 2 * CACHE_SIZE; i++)
+    {
+      struct cache_entry *e = &cache[clock_hand];
+      clock_hand = (clock_hand + 1) % CACHE_SIZE;
+      if (e->users > 0 || e->held)
+        continue;
+      if (!e->valid)
+        return e;
+      if (e->accessed)
+        e->accessed = false;
+      else
+        return e;
+    }
+  return NULL;
+}
+
+/* Returns the pinned entry for SECTOR, acquired for writing if
+   EXCLUSIVE and for reading otherwise.  If the sector is not
+   cached, an entry is evicted for it and, if LOAD is true, the
+   sector is read from disk; if LOAD is false the caller is about
+   to overwrite the whole sector and must acquire it EXCLUSIVE. */
+static struct cache_entry *
+cache_get (block_sector_t sector, bool exclusive, bool load)
+{
+  struct cache_entry *e;
+
+  ASSERT (load || exclusive);
+
+  lock_acquire (&cache_lock);
+  for (;;)
+    {
+      e = lookup (sector);
+      if (e != NULL)
+        {
+          hit_cnt++;
+          e->users++;
+          e->accessed = true;
+          lock_release (&cache_lock);
+          entry_acquire (e, exclusive);
+          return e;
+        }
+      if (being_evicted (sector))
+        {
+          /* Reading SECTOR now could get its old contents. */
+          cond_wait (&cache_evicted, &cache_lock);
+          continue;
+        }
+
+      e = choose_victim ();
+      if (e != NULL)
+        break;
+      cond_wait (&cache_unpinned, &cache_lock);
+    }
+  miss_cnt++;
+
+  /* E is unpinned, so no one holds its reader/writer lock and
+     we may take it for writing directly.  It holds SECTOR from
+     now on, so anyone else looking for SECTOR finds E and waits
+     for the entry.  Dirty old contents are written back without
+     cache_lock, and until they reach the disk anyone looking for
+     the old sector waits in the loop above instead of reading
+     it from disk. */
+  e->users = 1;
+  e->accessed = true;
+  e->writer = true;
+  e->evicting = e->valid && e->dirty;
+  e->old_sector = e->sector;
+  e->sector = sector;
+  e->valid = true;
+  e->dirty = false;
+  lock_release (&cache_lock);
+
+  if (e->evicting)
+    {
+      block_write (fs_device, e->old_sector, e->data);
+      lock_acquire (&cache_lock);
+      e->evicting = false;
+      cond_broadcast (&cache_evicted, &cache_lock);
+      lock_release (&cache_lock);
+    }
+  if (load)
+    block_read (fs_device, sector, e->data);
+  if (!exclusive)
+    {
+      lock_acquire (&e->lock);
+      e->writer = false;
+      e->readers = 1;
+      cond_broadcast (&e->cond, &e->lock);
+      lock_release (&e->lock);
+    }
+  return e;
+}
+
+/* Releases and unpins E, which was returned by cache_get(). */
+static void
+cache_put (struct cache_entry *e)
+{
+  entry_release (e);
+
+  lock_acquire (&cache_lock);
+  if (--e->users == 0)
+    cond_signal (&cache_unpinned, &cache_lock);
+  lock_release (&cache_lock);
+}
+
+/* Copies SIZE bytes starting at OFFSET within SECTOR on the file
+   system device into BUFFER. */
+void
+cache_read_at (block_sector_t sector, void *buffer, int offset, int size)
+{
+  struct cache_entry *e;
+
+  ASSERT (offset >= 0 && size >= 0 && offset + size <= BLOCK_SECTOR_SIZE);
+
+  e = cache_get (sector, false, true);
+  memcpy (buffer, e->data + offset, size);
+  cache_put (e);
+}
+
+/* Copies SIZE bytes from BUFFER to OFFSET within SECTOR, and
+   holds SECTOR's entry if HOLD is true. */
+static void
+write_at (block_sector_t sector, const void *buffer, int offset, int size,
+          bool hold)
+{
+  struct cache_entry *e;
+
+  ASSERT (offset >= 0 && size >= 0 && offset + size <= BLOCK_SECTOR_SIZE);
+
+  e = cache_get (sector, true, size < BLOCK_SECTOR_SIZE);
+  memcpy (e->data + offset, buffer, size);
+  e->dirty = true;
+  if (hold)
+    {
+      lock_acquire (&cache_lock);
+      e->held = true;
+      lock_release (&cache_lock);
+    }
+  cache_put (e);
+}
+
+/* Copies SIZE bytes from BUFFER to OFFSET within SECTOR on the
+   file system device.  The sector reaches the disk when it is
+   evicted or the cache is flushed. */
+void
+cache_write_at (block_sector_t sector, const void *buffer,
+                int offset, int size)
+{
+  write_at (sector, buffer, offset, size, false);
+}
+
+/* Like cache_write_at(), but also holds SECTOR in the cache,
+   without writing it to disk, until cache_release() is called
+   for it.  The journal uses this to keep metadata that is not
+   yet committed off the disk. */
+void
+cache_write_held (block_sector_t sector, const void *buffer,
+                  int offset, int size)
+{
+  write_at (sector, buffer, offset, size, true);
+}
+
+/* Releases SECTOR, which cache_write_held() holds in the cache,
+   so that it is written back like any other dirty sector. */
+void
+cache_release (block_sector_t sector)
+{
+  struct cache_entry *e;
+
+  lock_acquire (&cache_lock);
+  e = lookup (sector);
+  ASSERT (e != NULL && e->held);
+  e->held = false;
+  cond_signal (&cache_unpinned, &cache_lock);
+  lock_release (&cache_lock);
+}
+
+/* Fills SECTOR on the file system device with zeros, without
+   reading its old contents. */
+void
+cache_zero (block_sector_t sector)
+{
+  struct cache_entry *e = cache_get (sector, true, false);
+  memset (e->data, 0, BLOCK_SECTOR_SIZE);
+  e->dirty = true;
+  cache_put (e);
+}
+
+/* Writes SECTOR to disk now if its cached copy is dirty, and
+   returns once it is there.  SECTOR must not be held. */
+void
+cache_write_back (block_sector_t sector)
+{
+  struct cache_entry *e;
+
+  lock_acquire (&flush_lock);
+  lock_acquire (&cache_lock);
+  while ((e = lookup (sector)) == NULL && being_evicted (sector))
+    cond_wait (&cache_evicted, &cache_lock);
+  if (e != NULL)
+    {
+      ASSERT (!e->held);
+      e->users++;
+    }
+  lock_release (&cache_lock);
+
+  if (e != NULL)
+    {
+      entry_acquire (e, false);
+      if (e->dirty)
+        {
+          block_write (fs_device, sector, e->data);
+          e->dirty = false;
+        }
+      cache_put (e);
+    }
+  lock_release (&flush_lock);
+}
+
+/* Asks the read-ahead thread to bring SECTOR into the cache in
+   the background.  Returns without waiting. */
+void
+cache_read_ahead (block_sector_t sector)
+{
+  lock_acquire (&read_ahead_lock);
+  if (read_ahead_cnt < READ_AHEAD_QUEUE)
+    {
+      size_t tail = (read_ahead_head + read_ahead_cnt) % READ_AHEAD_QUEUE;
+      read_ahead_queue[tail] = sector;
+      read_ahead_cnt++;
+      cond_signal (&read_ahead_ready, &read_ahead_lock);
+    }
+  lock_release (&read_ahead_lock);
+}
+
+/* Reads the sectors queued by cache_read_ahead() that are not
+   already cached. */
+static void
+read_ahead_thread (void *aux UNUSED)
+{
+  for (;;)
+    {
+      block_sector_t sector;
+      bool cached;
+
+      lock_acquire (&read_ahead_lock);
+      while (read_ahead_cnt == 0)
+        cond_wait (&read_ahead_ready, &read_ahead_lock);
+      sector = read_ahead_queue[read_ahead_head];
+      read_ahead_head = (read_ahead_head + 1) % READ_AHEAD_QUEUE;
+      read_ahead_cnt--;
+      lock_release (&read_ahead_lock);
+
+      lock_acquire (&cache_lock);
+      cached = lookup (sector) != NULL;
+      lock_release (&cache_lock);
+      if (!cached)
+        cache_put (cache_get (sector, false, true));
+    }
+}
+
+/* Periodically writes dirty sectors back to disk, so that they
+   are mostly clean by the time they are evicted, and checkpoints
+   the journal while at it. */
+static void
+write_behind_thread (void *aux UNUSED)
+{
+  for (;;)
+    {
+      timer_sleep (WRITE_BEHIND_TICKS);
+      journal_checkpoint ();
+    }
+}
+
+/* Returns the valid, dirty, unheld entry with the lowest sector
+   number at or after SECTOR, or a null pointer if there is none.  DIRTY
+   is read without the entry's lock, which is good enough here:
+   only flushers clear it, and they hold flush_lock.  The caller
+   must hold cache_lock. */
+static struct cache_entry *
+lowest_dirty (block_sector_t sector)
+{
+  struct cache_entry *best = NULL;
+  size_t i;
+
+  for (i = 0; i < CACHE_SIZE; i++)
+    {
+      struct cache_entry *e = &cache[i];
+      if (e->valid && e->dirty && !e->held && e->sector >= sector
+          && (best == NULL || e->sector < best->sector))
+        best = e;
+    }
+  return best;
+}
+
+/* Writes every dirty sector in the cache that is not held to
+   disk, in ascending order, as runs of up to FLUSH_RUN
+   consecutive sectors, and waits for evictions in progress to
+   finish writing theirs. */
+void
+cache_flush (void)
+{
+  struct cache_entry *run[FLUSH_RUN];
+  block_sector_t next = 0;
+
+  lock_acquire (&flush_lock);
+  for (;;)
+    {
+      size_t cnt, i;
+
+      /* Pin the lowest dirty sector and the dirty sectors right
+         after it. */
+      lock_acquire (&cache_lock);
+      run[0] = lowest_dirty (next);
+      if (run[0] == NULL)
+        {
+          lock_release (&cache_lock);
+          break;
+        }
+      for (cnt = 1; cnt < FLUSH_RUN; cnt++)
+        {
+          struct cache_entry *e = lookup (run[0]->sector + cnt);
+          if (e == NULL || !e->dirty || e->held)
+            break;
+          run[cnt] = e;
+        }
+      for (i = 0; i < cnt; i++)
+        run[i]->users++;
+      lock_release (&cache_lock);
+
+      /* Readers never touch DIRTY, so it is safe to clear it
+         while holding the entries only for reading.  Holding
+         them until the write completes keeps a newer version
+         from reaching the disk first. */
+      for (i = 0; i < cnt; i++)
+        {
+          entry_acquire (run[i], false);
+          memcpy (flush_buffer + i * BLOCK_SECTOR_SIZE, run[i]->data,
+                  BLOCK_SECTOR_SIZE);
+        }
+      block_write_multiple (fs_device, run[0]->sector, cnt, flush_buffer);
+      next = run[0]->sector + cnt;
+      for (i = 0; i < cnt; i++)
+        {
+          run[i]->dirty = false;
+          cache_put (run[i]);
+        }
+    }
+
+  lock_acquire (&cache_lock);
+  for (;;)
+    {
+      size_t i;
+
+      for (i = 0; i < CACHE_SIZE; i++)
+        if (cache[i].evicting)
+          break;
+      if (i == CACHE_SIZE)
+        break;
+      cond_wait (&cache_evicted, &cache_lock);
+    }
+  lock_release (&cache_lock);
+  lock_release (&flush_lock);
+}
+
+/* Prints buffer cache statistics. */
+void
+cache_print_stats (void)
+{
+  printf ("Buffer cache: %lld hits, %lld misses\n", hit_cnt, miss_cnt);
+}
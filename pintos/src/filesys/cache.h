@@ -0,0 +1,17 @@
+#ifndef FILESYS_CACHE_H
+#define FILESYS_CACHE_H
+
+#include "devices/block.h"
+
+void cache_init (void);
+void cache_read_at (block_sector_t, void *, int offset, int size);
+void cache_write_at (block_sector_t, const void *, int offset, int size);
+void cache_write_held (block_sector_t, const void *, int offset, int size);
+void cache_release (block_sector_t);
+void cache_zero (block_sector_t);
+void cache_write_back (block_sector_t);
+void cache_read_ahead (block_sector_t);
+void cache_flush (void);
+void cache_print_stats (void);
+
+#endif /* filesys/cache.h */
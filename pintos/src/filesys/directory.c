@@ -1,15 +1,18 @@
 #include "filesys/directory.h"
 #include <stdio.h>
 #include <string.h>
+#include <hash.h>
 #include <list.h>
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
 #include "threads/malloc.h"
+#include "threads/synch.h"
 
 /* A directory. */
 struct dir
   {
     struct inode *inode;                /* Backing store. */
+    struct dir_index *index;            /* Index of the entries. */
     off_t pos;                          /* Current position. */
   };
 
@@ -21,6 +24,194 @@ struct dir_entry
     bool in_use;                        /* In use or free? */
   };
 
+/* In-memory index of a directory's entries, built when the
+   directory is first opened and shared by every struct dir open
+   on the same inode.  dir_add() and dir_remove() update it along
+   with the entries on disk, so lookups never read the disk. */
+struct dir_index
+  {
+    struct list_elem elem;              /* Element in open_indexes. */
+    block_sector_t sector;              /* Directory's inode sector. */
+    int open_cnt;                       /* Number of struct dirs using it. */
+    struct lock lock;                   /* Protects the members below. */
+    struct hash entries;                /* In-use entries, by name. */
+    off_t *free_slots;                  /* Offsets of unused entries. */
+    size_t free_cnt;                    /* Number of unused entries. */
+    size_t free_cap;                    /* Capacity of free_slots. */
+    off_t end;                          /* Offset just past the entries. */
+  };
+
+/* An in-use directory entry in a struct dir_index. */
+struct index_entry
+  {
+    struct hash_elem elem;              /* Element in dir_index's entries. */
+    off_t ofs;                          /* Offset of the entry on disk. */
+    block_sector_t inode_sector;        /* Sector number of header. */
+    char name[NAME_MAX + 1];            /* Null terminated file name. */
+  };
+
+/* Indexes of open directories, so that opening a directory twice
+   shares one index. */
+static struct list open_indexes;
+static struct lock open_indexes_lock;
+
+/* Initializes the directory module. */
+void
+dir_init (void)
+{
+  list_init (&open_indexes);
+  lock_init (&open_indexes_lock);
+}
+
+static unsigned
+index_entry_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  return hash_string (hash_entry (e, struct index_entry, elem)->name);
+}
+
+static bool
+index_entry_less (const struct hash_elem *a, const struct hash_elem *b,
+                  void *aux UNUSED)
+{
+  return strcmp (hash_entry (a, struct index_entry, elem)->name,
+                 hash_entry (b, struct index_entry, elem)->name) < 0;
+}
+
+static void
+index_entry_free (struct hash_elem *e, void *aux UNUSED)
+{
+  free (hash_entry (e, struct index_entry, elem));
+}
+
+/* Adds an entry NAME for INODE_SECTOR at offset OFS to INDEX and
+   returns it, or returns a null pointer if memory allocation
+   fails. */
+static struct index_entry *
+index_add (struct dir_index *index, const char *name,
+           block_sector_t inode_sector, off_t ofs)
+{
+  struct index_entry *ie = malloc (sizeof *ie);
+  if (ie == NULL)
+    return NULL;
+  ie->ofs = ofs;
+  ie->inode_sector = inode_sector;
+  strlcpy (ie->name, name, sizeof ie->name);
+  hash_insert (&index->entries, &ie->elem);
+  return ie;
+}
+
+/* Records that the entry at OFS in INDEX is unused.  If memory
+   runs out the slot is simply not reused until the directory is
+   reopened. */
+static void
+index_add_free_slot (struct dir_index *index, off_t ofs)
+{
+  if (index->free_cnt == index->free_cap)
+    {
+      size_t cap = index->free_cap ? 2 * index->free_cap : 8;
+      off_t *slots = realloc (index->free_slots, cap * sizeof *slots);
+      if (slots == NULL)
+        return;
+      index->free_slots = slots;
+      index->free_cap = cap;
+    }
+  index->free_slots[index->free_cnt++] = ofs;
+}
+
+/* Returns the entry for NAME in INDEX, or a null pointer if
+   there is none.  The caller must hold INDEX's lock. */
+static struct index_entry *
+index_find (struct dir_index *index, const char *name)
+{
+  struct index_entry key;
+  struct hash_elem *e;
+
+  if (strlen (name) > NAME_MAX)
+    return NULL;
+  strlcpy (key.name, name, sizeof key.name);
+  e = hash_find (&index->entries, &key.elem);
+  return e != NULL ? hash_entry (e, struct index_entry, elem) : NULL;
+}
+
+/* Frees INDEX and everything in it. */
+static void
+index_destroy (struct dir_index *index)
+{
+  hash_destroy (&index->entries, index_entry_free);
+  free (index->free_slots);
+  free (index);
+}
+
+/* Returns the index of the directory in INODE, reading the
+   directory to build it if it is not open already.  Returns a
+   null pointer if memory allocation fails. */
+static struct dir_index *
+index_open (struct inode *inode)
+{
+  block_sector_t sector = inode_get_inumber (inode);
+  struct dir_index *index;
+  struct list_elem *le;
+  struct dir_entry e;
+  off_t ofs;
+
+  lock_acquire (&open_indexes_lock);
+  for (le = list_begin (&open_indexes); le != list_end (&open_indexes);
+       le = list_next (le))
+    {
+      index = list_entry (le, struct dir_index, elem);
+      if (index->sector == sector)
+        {
+          index->open_cnt++;
+          lock_release (&open_indexes_lock);
+          return index;
+        }
+    }
+
+  index = calloc (1, sizeof *index);
+  if (index == NULL
+      || !hash_init (&index->entries, index_entry_hash, index_entry_less,
+                     NULL))
+    {
+      free (index);
+      lock_release (&open_indexes_lock);
+      return NULL;
+    }
+  index->sector = sector;
+  index->open_cnt = 1;
+  lock_init (&index->lock);
+
+  for (ofs = 0; inode_read_at (inode, &e, sizeof e, ofs) == sizeof e;
+       ofs += sizeof e)
+    {
+      if (!e.in_use)
+        index_add_free_slot (index, ofs);
+      else if (index_add (index, e.name, e.inode_sector, ofs) == NULL)
+        {
+          index_destroy (index);
+          lock_release (&open_indexes_lock);
+          return NULL;
+        }
+    }
+  index->end = ofs;
+
+  list_push_front (&open_indexes, &index->elem);
+  lock_release (&open_indexes_lock);
+  return index;
+}
+
+/* Releases INDEX, freeing it if this was its last user. */
+static void
+index_close (struct dir_index *index)
+{
+  lock_acquire (&open_indexes_lock);
+  if (--index->open_cnt == 0)
+    {
+      list_remove (&index->elem);
+      index_destroy (index);
+    }
+  lock_release (&open_indexes_lock);
+}
+
 /* Creates a directory with space for ENTRY_CNT entries in the
    given SECTOR.  Returns true if successful, false on failure. */
 bool
@@ -35,8 +226,10 @@ struct dir *
 dir_open (struct inode *inode)
 {
   struct dir *dir = calloc (1, sizeof *dir);
-  if (inode != NULL && dir != NULL)
+  if (inode != NULL && dir != NULL
+      && (dir->index = index_open (inode)) != NULL)
     {
+      inode_set_journaled (inode);
       dir->inode = inode;
       dir->pos = 0;
       return dir;
@@ -71,6 +264,7 @@ dir_close (struct dir *dir)
 {
   if (dir != NULL)
     {
+      index_close (dir->index);
       inode_close (dir->inode);
       free (dir);
     }
@@ -83,34 +277,6 @@ dir_get_inode (struct dir *dir)
   return dir->inode;
 }
 
-/* Searches DIR for a file with the given NAME.
-   If successful, returns true, sets *EP to the directory entry
-   if EP is non-null, and sets *OFSP to the byte offset of the
-   directory entry if OFSP is non-null.
-   otherwise, returns false and ignores EP and OFSP. */
-static bool
-lookup (const struct dir *dir, const char *name,
-        struct dir_entry *ep, off_t *ofsp)
-{
-  struct dir_entry e;
-  size_t ofs;
-
-  ASSERT (dir != NULL);
-  ASSERT (name != NULL);
-
-  for (ofs = 0; inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
-       ofs += sizeof e)
-    if (e.in_use && !strcmp (name, e.name))
-      {
-        if (ep != NULL)
-          *ep = e;
-        if (ofsp != NULL)
-          *ofsp = ofs;
-        return true;
-      }
-  return false;
-}
-
 /* Searches DIR for a file with the given NAME
    and returns true if one exists, false otherwise.
    On success, sets *INODE to an inode for the file, otherwise to
@@ -119,15 +285,15 @@ bool
 dir_lookup (const struct dir *dir, const char *name,
             struct inode **inode)
 {
-  struct dir_entry e;
+  struct index_entry *ie;
 
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
 
-  if (lookup (dir, name, &e, NULL))
-    *inode = inode_open (e.inode_sector);
-  else
-    *inode = NULL;
+  lock_acquire (&dir->index->lock);
+  ie = index_find (dir->index, name);
+  *inode = ie != NULL ? inode_open (ie->inode_sector) : NULL;
+  lock_release (&dir->index->lock);
 
   return *inode != NULL;
 }
@@ -141,6 +307,8 @@ dir_lookup (const struct dir *dir, const char *name,
 bool
 dir_add (struct dir *dir, const char *name, block_sector_t inode_sector)
 {
+  struct dir_index *index = dir->index;
+  struct index_entry *ie;
   struct dir_entry e;
   off_t ofs;
   bool success = false;
@@ -152,29 +320,38 @@ dir_add (struct dir *dir, const char *name, block_sector_t inode_sector)
   if (*name == '\0' || strlen (name) > NAME_MAX)
     return false;
 
+  lock_acquire (&index->lock);
+
   /* Check that NAME is not in use. */
-  if (lookup (dir, name, NULL, NULL))
+  if (index_find (index, name) != NULL)
     goto done;
 
   /* Set OFS to offset of free slot.
      If there are no free slots, then it will be set to the
-     current end-of-file.
-
-     inode_read_at() will only return a short read at end of file.
-     Otherwise, we'd need to verify that we didn't get a short
-     read due to something intermittent such as low memory. */
-  for (ofs = 0; inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
-       ofs += sizeof e)
-    if (!e.in_use)
-      break;
+     current end-of-file. */
+  ofs = index->free_cnt > 0 ? index->free_slots[index->free_cnt - 1]
+                            : index->end;
+  ie = index_add (index, name, inode_sector, ofs);
+  if (ie == NULL)
+    goto done;
 
   /* Write slot. */
   e.in_use = true;
   strlcpy (e.name, name, sizeof e.name);
   e.inode_sector = inode_sector;
   success = inode_write_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
+  if (!success)
+    {
+      hash_delete (&index->entries, &ie->elem);
+      free (ie);
+    }
+  else if (ofs == index->end)
+    index->end += sizeof e;
+  else
+    index->free_cnt--;
 
  done:
+  lock_release (&index->lock);
   return success;
 }
 
@@ -184,33 +361,43 @@ dir_add (struct dir *dir, const char *name, block_sector_t inode_sector)
 bool
 dir_remove (struct dir *dir, const char *name)
 {
+  struct dir_index *index = dir->index;
+  struct index_entry *ie;
   struct dir_entry e;
   struct inode *inode = NULL;
   bool success = false;
-  off_t ofs;
 
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
 
+  lock_acquire (&index->lock);
+
   /* Find directory entry. */
-  if (!lookup (dir, name, &e, &ofs))
+  ie = index_find (index, name);
+  if (ie == NULL)
     goto done;
 
   /* Open inode. */
-  inode = inode_open (e.inode_sector);
+  inode = inode_open (ie->inode_sector);
   if (inode == NULL)
     goto done;
 
   /* Erase directory entry. */
+  e.inode_sector = ie->inode_sector;
+  strlcpy (e.name, ie->name, sizeof e.name);
   e.in_use = false;
-  if (inode_write_at (dir->inode, &e, sizeof e, ofs) != sizeof e)
+  if (inode_write_at (dir->inode, &e, sizeof e, ie->ofs) != sizeof e)
     goto done;
+  hash_delete (&index->entries, &ie->elem);
+  index_add_free_slot (index, ie->ofs);
+  free (ie);
 
   /* Remove inode. */
   inode_remove (inode);
   success = true;
 
  done:
+  lock_release (&index->lock);
   inode_close (inode);
   return success;
 }
@@ -2,10 +2,12 @@
 #include <debug.h>
 #include <stdio.h>
 #include <string.h>
+#include "filesys/cache.h"
 #include "filesys/file.h"
 #include "filesys/free-map.h"
 #include "filesys/inode.h"
 #include "filesys/directory.h"
+#include "filesys/journal.h"
 
 /* Partition that contains the file system. */
 struct block *fs_device;
@@ -21,12 +23,16 @@ filesys_init (bool format)
   if (fs_device == NULL)
     PANIC ("No file system device found, can't initialize file system.");
 
+  cache_init ();
+  journal_init ();
   inode_init ();
+  dir_init ();
   free_map_init ();
 
   if (format)
     do_format ();
 
+  journal_open ();
   free_map_open ();
 }
 
@@ -36,24 +42,31 @@ void
 filesys_done (void)
 {
   free_map_close ();
+  journal_close ();
 }
 
 /* Creates a file named NAME with the given INITIAL_SIZE.
    Returns true if successful, false otherwise.
    Fails if a file named NAME already exists,
-   or if internal memory allocation fails. */
+   or if internal memory allocation fails.
+   The file is created in a single journal transaction. */
 bool
 filesys_create (const char *name, off_t initial_size)
 {
   block_sector_t inode_sector = 0;
-  struct dir *dir = dir_open_root ();
-  bool success = (dir != NULL
-                  && free_map_allocate (1, &inode_sector)
-                  && inode_create (inode_sector, initial_size)
-                  && dir_add (dir, name, inode_sector));
+  struct dir *dir;
+  bool success;
+
+  journal_begin ();
+  dir = dir_open_root ();
+  success = (dir != NULL
+             && free_map_allocate (1, &inode_sector)
+             && inode_create (inode_sector, initial_size)
+             && dir_add (dir, name, inode_sector));
   if (!success && inode_sector != 0)
     free_map_release (inode_sector, 1);
   dir_close (dir);
+  journal_end ();
 
   return success;
 }
@@ -79,13 +92,19 @@ filesys_open (const char *name)
 /* Deletes the file named NAME.
    Returns true if successful, false on failure.
    Fails if no file named NAME exists,
-   or if an internal memory allocation fails. */
+   or if an internal memory allocation fails.
+   The file is removed in a single journal transaction. */
 bool
 filesys_remove (const char *name)
 {
-  struct dir *dir = dir_open_root ();
-  bool success = dir != NULL && dir_remove (dir, name);
+  struct dir *dir;
+  bool success;
+
+  journal_begin ();
+  dir = dir_open_root ();
+  success = dir != NULL && dir_remove (dir, name);
   dir_close (dir);
+  journal_end ();
 
   return success;
 }
@@ -99,5 +118,6 @@ do_format (void)
   if (!dir_create (ROOT_DIR_SECTOR, 16))
     PANIC ("root directory creation failed");
   free_map_close ();
+  journal_create ();
   printf ("done.\n");
 }
@@ -8,8 +8,12 @@
 #define FREE_MAP_SECTOR 0       /* Free map file inode sector. */
 #define ROOT_DIR_SECTOR 1       /* Root directory file inode sector. */
 
+/* Sectors of the metadata journal. */
+#define JOURNAL_SECTOR 2        /* First journal sector. */
+#define JOURNAL_SIZE 128        /* Number of journal sectors. */
+
 /* Block device that contains the file system. */
-struct block *fs_device;
+extern struct block *fs_device;
 
 void filesys_init (bool format);
 void filesys_done (void);
@@ -1,70 +1,246 @@
 #include "filesys/free-map.h"
 #include <bitmap.h>
 #include <debug.h>
+#include <round.h>
 #include "filesys/file.h"
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
+#include "filesys/journal.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
+
+/* Number of sectors summarized by each entry of region_free. */
+#define REGION_SIZE 256
+
+/* Number of free map bits stored in each sector of its file. */
+#define BITS_PER_SECTOR (BLOCK_SECTOR_SIZE * 8)
 
 static struct file *free_map_file;   /* Free map file. */
 static struct bitmap *free_map;      /* Free map, one bit per sector. */
+static struct bitmap *dirty;         /* Free map file sectors that are
+                                        out of date, one bit each. */
+static struct lock free_map_lock;    /* Protects all of these. */
+
+/* Sectors that have been released but may still be overwritten by
+   replaying images of them in the journal.  They are free on disk
+   but are not handed out again until the journal is checkpointed,
+   so that a crash cannot clobber whatever they are reused for. */
+static struct bitmap *deferred;
+
+/* Number of free sectors in each REGION_SIZE-sector region of the
+   free map, so that full regions can be skipped without looking
+   at their bits. */
+static size_t *region_free;
+static size_t region_cnt;
+
+/* Where the next allocation starts looking: just past the end of
+   the previous one. */
+static block_sector_t next_fit;
+
+/* Recounts the free sectors in every region. */
+static void
+count_regions (void)
+{
+  size_t bit_cnt = bitmap_size (free_map);
+  size_t r;
+
+  for (r = 0; r < region_cnt; r++)
+    {
+      size_t start = r * REGION_SIZE;
+      size_t cnt = bit_cnt - start;
+      if (cnt > REGION_SIZE)
+        cnt = REGION_SIZE;
+      region_free[r] = bitmap_count (free_map, start, cnt, false);
+    }
+}
+
+/* Marks CNT sectors starting at SECTOR as USED or free, keeping
+   the region counts up to date. */
+static void
+mark_sectors (block_sector_t sector, size_t cnt, bool used)
+{
+  size_t first = sector / BITS_PER_SECTOR;
+  size_t last = (sector + cnt - 1) / BITS_PER_SECTOR;
+
+  bitmap_set_multiple (free_map, sector, cnt, used);
+  bitmap_set_multiple (dirty, first, last - first + 1, true);
+  while (cnt > 0)
+    {
+      size_t r = sector / REGION_SIZE;
+      size_t n = (r + 1) * REGION_SIZE - sector;
+      if (n > cnt)
+        n = cnt;
+      if (used)
+        region_free[r] -= n;
+      else
+        region_free[r] += n;
+      sector += n;
+      cnt -= n;
+    }
+}
+
+/* Returns the first sector of a run of CNT free sectors that
+   starts at or after FROM and within region R, or BITMAP_ERROR
+   if there is none. */
+static size_t
+scan_region (size_t r, size_t from, size_t cnt)
+{
+  size_t bit_cnt = bitmap_size (free_map);
+  size_t limit = (r + 1) * REGION_SIZE + cnt - 1;
+  size_t run = 0;
+  size_t i;
+
+  /* A run of up to REGION_SIZE sectors starting in R lies within
+     R and the region after it. */
+  if (region_free[r] == 0
+      || (cnt <= REGION_SIZE
+          && region_free[r] + (r + 1 < region_cnt ? region_free[r + 1] : 0)
+             < cnt))
+    return BITMAP_ERROR;
+
+  if (limit > bit_cnt)
+    limit = bit_cnt;
+  for (i = from; i < limit; i++)
+    if (bitmap_test (free_map, i) || bitmap_test (deferred, i))
+      run = 0;
+    else if (++run == cnt)
+      return i - (cnt - 1);
+  return BITMAP_ERROR;
+}
 
 /* Initializes the free map. */
 void
 free_map_init (void)
 {
+  lock_init (&free_map_lock);
   free_map = bitmap_create (block_size (fs_device));
-  if (free_map == NULL)
+  deferred = bitmap_create (block_size (fs_device));
+  dirty = bitmap_create (DIV_ROUND_UP (block_size (fs_device),
+                                       BITS_PER_SECTOR));
+  if (free_map == NULL || deferred == NULL || dirty == NULL)
     PANIC ("bitmap creation failed--file system device is too large");
+  region_cnt = DIV_ROUND_UP (bitmap_size (free_map), REGION_SIZE);
+  region_free = malloc (region_cnt * sizeof *region_free);
+  if (region_free == NULL)
+    PANIC ("free map region summary allocation failed");
   bitmap_mark (free_map, FREE_MAP_SECTOR);
   bitmap_mark (free_map, ROOT_DIR_SECTOR);
+  bitmap_set_multiple (free_map, JOURNAL_SECTOR, JOURNAL_SIZE, true);
+  count_regions ();
 }
 
 /* Allocates CNT consecutive sectors from the free map and stores
    the first into *SECTORP.
    Returns true if successful, false if not enough consecutive
-   sectors were available or if the free_map file could not be
-   written. */
+   sectors were available.
+
+   Allocation is next fit: the search starts where the previous
+   allocation ended and wraps around once.  The free map is only
+   updated in memory; free_map_flush() writes it out as part of
+   the caller's journal transaction. */
 bool
 free_map_allocate (size_t cnt, block_sector_t *sectorp)
 {
-  block_sector_t sector = bitmap_scan_and_flip (free_map, 0, cnt, false);
-  if (sector != BITMAP_ERROR
-      && free_map_file != NULL
-      && !bitmap_write (free_map, free_map_file))
+  size_t sector = BITMAP_ERROR;
+  size_t first, i;
+
+  lock_acquire (&free_map_lock);
+  first = next_fit / REGION_SIZE;
+  for (i = 0; i <= region_cnt && sector == BITMAP_ERROR; i++)
     {
-      bitmap_set_multiple (free_map, sector, cnt, false);
-      sector = BITMAP_ERROR;
+      size_t r = (first + i) % region_cnt;
+      size_t from = i == 0 ? next_fit : r * REGION_SIZE;
+      sector = scan_region (r, from, cnt);
     }
   if (sector != BITMAP_ERROR)
-    *sectorp = sector;
+    {
+      mark_sectors (sector, cnt, true);
+      next_fit = (sector + cnt) % bitmap_size (free_map);
+      *sectorp = sector;
+    }
+  lock_release (&free_map_lock);
   return sector != BITMAP_ERROR;
 }
 
-/* Makes CNT sectors starting at SECTOR available for use. */
+/* Makes CNT sectors starting at SECTOR available for use.
+   Sectors that the journal holds images of become available only
+   after the next journal checkpoint. */
 void
 free_map_release (block_sector_t sector, size_t cnt)
 {
+  size_t i;
+
+  lock_acquire (&free_map_lock);
   ASSERT (bitmap_all (free_map, sector, cnt));
-  bitmap_set_multiple (free_map, sector, cnt, false);
-  bitmap_write (free_map, free_map_file);
+  mark_sectors (sector, cnt, false);
+  for (i = sector; i < sector + cnt; i++)
+    if (journal_logged (i))
+      {
+        bitmap_mark (deferred, i);
+        region_free[i / REGION_SIZE]--;
+      }
+  lock_release (&free_map_lock);
+}
+
+/* Makes the sectors whose release free_map_release() deferred
+   available for use.  Called by the journal once it no longer
+   holds images of any of them. */
+void
+free_map_reclaim (void)
+{
+  size_t i;
+
+  lock_acquire (&free_map_lock);
+  for (i = 0; (i = bitmap_scan (deferred, i, 1, true)) != BITMAP_ERROR; i++)
+    {
+      bitmap_reset (deferred, i);
+      region_free[i / REGION_SIZE]++;
+    }
+  lock_release (&free_map_lock);
+}
+
+/* Writes the sectors of the free map file that have changed
+   since they were last written. */
+void
+free_map_flush (void)
+{
+  size_t i;
+
+  lock_acquire (&free_map_lock);
+  if (free_map_file != NULL)
+    for (i = 0; (i = bitmap_scan (dirty, i, 1, true)) != BITMAP_ERROR; i++)
+      if (bitmap_write_part (free_map, free_map_file,
+                             i * BLOCK_SECTOR_SIZE, BLOCK_SECTOR_SIZE))
+        bitmap_reset (dirty, i);
+  lock_release (&free_map_lock);
 }
 
 /* Opens the free map file and reads it from disk. */
 void
 free_map_open (void)
 {
-  free_map_file = file_open (inode_open (FREE_MAP_SECTOR));
+  struct inode *inode = inode_open (FREE_MAP_SECTOR);
+
+  if (inode != NULL)
+    inode_set_journaled (inode);
+  free_map_file = file_open (inode);
   if (free_map_file == NULL)
     PANIC ("can't open free map");
   if (!bitmap_read (free_map, free_map_file))
     PANIC ("can't read free map");
+  count_regions ();
+  bitmap_set_all (dirty, false);
 }
 
 /* Writes the free map to disk and closes the free map file. */
 void
 free_map_close (void)
 {
+  journal_begin ();
+  free_map_flush ();
+  journal_end ();
   file_close (free_map_file);
+  free_map_file = NULL;
 }
 
 /* Creates a new free map file on disk and writes the free map to
@@ -72,14 +248,19 @@ free_map_close (void)
 void
 free_map_create (void)
 {
+  struct file *file;
+
   /* Create inode. */
   if (!inode_create (FREE_MAP_SECTOR, bitmap_file_size (free_map)))
     PANIC ("free map creation failed");
 
-  /* Write bitmap to file. */
-  free_map_file = file_open (inode_open (FREE_MAP_SECTOR));
-  if (free_map_file == NULL)
+  /* Write bitmap to file.  Writing allocates the file's sectors,
+     so the free map is left dirty for free_map_close() to write
+     out again. */
+  file = file_open (inode_open (FREE_MAP_SECTOR));
+  if (file == NULL)
     PANIC ("can't open free map");
-  if (!bitmap_write (free_map, free_map_file))
+  if (!bitmap_write (free_map, file))
     PANIC ("can't write free map");
+  free_map_file = file;
 }
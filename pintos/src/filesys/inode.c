@@ -1,74 +1,209 @@
 #include "filesys/inode.h"
-#include <list.h>
+#include <hash.h>
 #include <debug.h>
 #include <round.h>
 #include <string.h>
+#include "filesys/cache.h"
 #include "filesys/filesys.h"
 #include "filesys/free-map.h"
+#include "filesys/journal.h"
 #include "threads/malloc.h"
+#include "threads/synch.h"
 
 /* Identifies an inode. */
 #define INODE_MAGIC 0x494e4f44
 
+/* Maximum number of sectors to read ahead of a sequential reader. */
+#define READ_AHEAD_MAX 16
+
+/* Maximum number of sectors inode_write_at() writes in one
+   journal transaction. */
+#define WRITE_TXN_MAX 16
+
+/* Number of data sectors an inode points to directly. */
+#define DIRECT_CNT 124
+
+/* Number of sector numbers in an index block. */
+#define INDEX_CNT (BLOCK_SECTOR_SIZE / sizeof (block_sector_t))
+
 /* On-disk inode.
-   Must be exactly BLOCK_SECTOR_SIZE bytes long. */
+   Must be exactly BLOCK_SECTOR_SIZE bytes long.
+
+   Data sectors are found through DIRECT, then through the index
+   block INDIRECT, then through the index block DOUBLY_INDIRECT,
+   whose entries are themselves index blocks.  A sector number of
+   0 means that the sector, and everything below it, has not been
+   allocated yet; such holes read as zeros.  (Sector 0 holds the
+   free map inode, so it is never a data or index sector.) */
 struct inode_disk
   {
-    block_sector_t start;               /* First data sector. */
+    block_sector_t direct[DIRECT_CNT];  /* Direct data sectors. */
+    block_sector_t indirect;            /* Index block of data sectors. */
+    block_sector_t doubly_indirect;     /* Index block of index blocks. */
     off_t length;                       /* File size in bytes. */
     unsigned magic;                     /* Magic number. */
-    uint32_t unused[125];               /* Not used. */
   };
 
-/* Returns the number of sectors to allocate for an inode SIZE
-   bytes long. */
-static inline size_t
-bytes_to_sectors (off_t size)
-{
-  return DIV_ROUND_UP (size, BLOCK_SECTOR_SIZE);
-}
-
 /* In-memory inode. */
 struct inode
   {
-    struct list_elem elem;              /* Element in inode list. */
+    struct hash_elem elem;              /* Element in open_inodes. */
     block_sector_t sector;              /* Sector number of disk location. */
     int open_cnt;                       /* Number of openers. */
     bool removed;                       /* True if deleted, false otherwise. */
+    bool journaled;                     /* Journal data writes, too? */
     int deny_write_cnt;                 /* 0: writes ok, >0: deny writes. */
+    struct lock lock;                   /* Serializes allocation and growth. */
+    off_t read_next;                    /* Offset just past the last read. */
+    off_t read_ahead_end;               /* Read ahead queued up to here. */
+    int read_ahead_window;              /* Sectors to keep read ahead. */
     struct inode_disk data;             /* Inode content. */
   };
 
+/* Allocates a sector and fills it with zeros in the buffer
+   cache.  Returns the sector, or 0 if the disk is full.  An
+   INDEX block is zeroed as part of the running transaction, so
+   that a replay never finds it pointed to but full of old
+   contents.  A data sector is only zeroed in the cache: its
+   writer must get it to disk before publishing it. */
+static block_sector_t
+allocate_sector (bool index)
+{
+  static const uint8_t zeros[BLOCK_SECTOR_SIZE];
+  block_sector_t sector;
+
+  if (!free_map_allocate (1, &sector))
+    return 0;
+  if (index)
+    journal_write_at (sector, zeros, 0, BLOCK_SECTOR_SIZE);
+  else
+    cache_zero (sector);
+  return sector;
+}
+
+/* Returns the sector number in *SLOT, a pointer into INODE's
+   on-disk inode.  If it is 0 and CREATE is true, allocates a
+   sector for it first, which is an index block if INDEX is
+   true. */
+static block_sector_t
+inode_slot (struct inode *inode, block_sector_t *slot, bool create,
+            bool index)
+{
+  if (*slot == 0 && create && (*slot = allocate_sector (index)) != 0)
+    journal_write_at (inode->sector, &inode->data, 0, BLOCK_SECTOR_SIZE);
+  return *slot;
+}
+
+/* Returns entry IDX of index block BLOCK, which is read through
+   the buffer cache.  If it is 0 and CREATE is true, allocates a
+   sector for it first, which is an index block if INDEX is
+   true. */
+static block_sector_t
+index_slot (block_sector_t block, size_t idx, bool create, bool index)
+{
+  block_sector_t sector;
+
+  cache_read_at (block, &sector, idx * sizeof sector, sizeof sector);
+  if (sector == 0 && create && (sector = allocate_sector (index)) != 0)
+    journal_write_at (block, &sector, idx * sizeof sector, sizeof sector);
+  return sector;
+}
+
 /* Returns the block device sector that contains byte offset POS
-   within INODE.
-   Returns -1 if INODE does not contain data for a byte at offset
-   POS. */
+   within INODE, or 0 if that sector has not been allocated.
+   If CREATE is true, allocates the sector and any index blocks
+   leading to it, returning 0 only if the disk is full or POS is
+   beyond the largest possible file.  The caller must hold
+   INODE's lock and be in a journal transaction if CREATE is
+   true. */
 static block_sector_t
-byte_to_sector (const struct inode *inode, off_t pos)
+byte_to_sector (struct inode *inode, off_t pos, bool create)
 {
+  struct inode_disk *data = &inode->data;
+  size_t idx = pos / BLOCK_SECTOR_SIZE;
+  block_sector_t block;
+
   ASSERT (inode != NULL);
-  if (pos < inode->data.length)
-    return inode->data.start + pos / BLOCK_SECTOR_SIZE;
-  else
-    return -1;
+  ASSERT (pos >= 0);
+
+  if (idx < DIRECT_CNT)
+    return inode_slot (inode, &data->direct[idx], create, false);
+  idx -= DIRECT_CNT;
+
+  if (idx < INDEX_CNT)
+    {
+      block = inode_slot (inode, &data->indirect, create, true);
+      return block != 0 ? index_slot (block, idx, create, false) : 0;
+    }
+  idx -= INDEX_CNT;
+
+  if (idx < INDEX_CNT * INDEX_CNT)
+    {
+      block = inode_slot (inode, &data->doubly_indirect, create, true);
+      if (block != 0)
+        block = index_slot (block, idx / INDEX_CNT, create, true);
+      return (block != 0
+              ? index_slot (block, idx % INDEX_CNT, create, false) : 0);
+    }
+  return 0;
+}
+
+/* Frees BLOCK, which is a data sector if LEVEL is 0 and otherwise
+   an index block whose entries have level LEVEL - 1, along with
+   everything it points to. */
+static void
+release_sectors (block_sector_t block, int level)
+{
+  if (block == 0)
+    return;
+  if (level > 0)
+    {
+      block_sector_t entries[INDEX_CNT];
+      size_t i;
+
+      cache_read_at (block, entries, 0, BLOCK_SECTOR_SIZE);
+      for (i = 0; i < INDEX_CNT; i++)
+        release_sectors (entries[i], level - 1);
+    }
+  free_map_release (block, 1);
+}
+
+/* Open inodes, hashed by sector, so that opening a single inode
+   twice returns the same `struct inode'.  open_inodes_lock
+   protects the table and every inode's OPEN_CNT. */
+static struct hash open_inodes;
+static struct lock open_inodes_lock;
+
+static unsigned
+inode_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  return hash_int (hash_entry (e, struct inode, elem)->sector);
 }
 
-/* List of open inodes, so that opening a single inode twice
-   returns the same `struct inode'. */
-static struct list open_inodes;
+static bool
+inode_less (const struct hash_elem *a, const struct hash_elem *b,
+            void *aux UNUSED)
+{
+  return (hash_entry (a, struct inode, elem)->sector
+          < hash_entry (b, struct inode, elem)->sector);
+}
 
 /* Initializes the inode module. */
 void
 inode_init (void)
 {
-  list_init (&open_inodes);
+  if (!hash_init (&open_inodes, inode_hash, inode_less, NULL))
+    PANIC ("open inode table creation failed");
+  lock_init (&open_inodes_lock);
 }
 
 /* Initializes an inode with LENGTH bytes of data and
    writes the new inode to sector SECTOR on the file system
-   device.
+   device, as part of the caller's journal transaction.  No data
+   sectors are allocated until they are written; until then they
+   read as zeros.
    Returns true if successful.
-   Returns false if memory or disk allocation fails. */
+   Returns false if memory allocation fails. */
 bool
 inode_create (block_sector_t sector, off_t length)
 {
@@ -84,60 +219,62 @@ inode_create (block_sector_t sector, off_t length)
   disk_inode = calloc (1, sizeof *disk_inode);
   if (disk_inode != NULL)
     {
-      size_t sectors = bytes_to_sectors (length);
       disk_inode->length = length;
       disk_inode->magic = INODE_MAGIC;
-      if (free_map_allocate (sectors, &disk_inode->start))
-        {
-          block_write (fs_device, sector, disk_inode);
-          if (sectors > 0)
-            {
-              static char zeros[BLOCK_SECTOR_SIZE];
-              size_t i;
-
-              for (i = 0; i < sectors; i++)
-                block_write (fs_device, disk_inode->start + i, zeros);
-            }
-          success = true;
-        }
+      journal_write_at (sector, disk_inode, 0, BLOCK_SECTOR_SIZE);
       free (disk_inode);
+      success = true;
     }
   return success;
 }
 
 /* Reads an inode from SECTOR
    and returns a `struct inode' that contains it.
+   The on-disk inode is read only when SECTOR is not open
+   already; after that it is kept in the `struct inode'.
    Returns a null pointer if memory allocation fails. */
 struct inode *
 inode_open (block_sector_t sector)
 {
-  struct list_elem *e;
+  struct inode key;
+  struct hash_elem *e;
   struct inode *inode;
 
+  lock_acquire (&open_inodes_lock);
+
   /* Check whether this inode is already open. */
-  for (e = list_begin (&open_inodes); e != list_end (&open_inodes);
-       e = list_next (e))
+  key.sector = sector;
+  e = hash_find (&open_inodes, &key.elem);
+  if (e != NULL)
     {
-      inode = list_entry (e, struct inode, elem);
-      if (inode->sector == sector)
-        {
-          inode_reopen (inode);
-          return inode;
-        }
+      inode = hash_entry (e, struct inode, elem);
+      inode->open_cnt++;
+      lock_release (&open_inodes_lock);
+      return inode;
     }
 
   /* Allocate memory. */
   inode = malloc (sizeof *inode);
   if (inode == NULL)
-    return NULL;
+    {
+      lock_release (&open_inodes_lock);
+      return NULL;
+    }
 
-  /* Initialize. */
-  list_push_front (&open_inodes, &inode->elem);
+  /* Initialize.  The disk inode is read before the lock is
+     released, so that no one sees it half read. */
+  hash_insert (&open_inodes, &inode->elem);
   inode->sector = sector;
   inode->open_cnt = 1;
   inode->deny_write_cnt = 0;
   inode->removed = false;
-  block_read (fs_device, inode->sector, &inode->data);
+  inode->journaled = false;
+  lock_init (&inode->lock);
+  inode->read_next = 0;
+  inode->read_ahead_end = 0;
+  inode->read_ahead_window = 0;
+  cache_read_at (inode->sector, &inode->data, 0, BLOCK_SECTOR_SIZE);
+  lock_release (&open_inodes_lock);
   return inode;
 }
 
@@ -146,10 +283,23 @@ struct inode *
 inode_reopen (struct inode *inode)
 {
   if (inode != NULL)
-    inode->open_cnt++;
+    {
+      lock_acquire (&open_inodes_lock);
+      inode->open_cnt++;
+      lock_release (&open_inodes_lock);
+    }
   return inode;
 }
 
+/* Makes writes to INODE's data part of journal transactions, as
+   they must be for inodes whose data is itself metadata, such as
+   directories. */
+void
+inode_set_journaled (struct inode *inode)
+{
+  inode->journaled = true;
+}
+
 /* Returns INODE's inode number. */
 block_sector_t
 inode_get_inumber (const struct inode *inode)
@@ -163,22 +313,33 @@ inode_get_inumber (const struct inode *inode)
 void
 inode_close (struct inode *inode)
 {
+  bool last;
+
   /* Ignore null pointer. */
   if (inode == NULL)
     return;
 
   /* Release resources if this was the last opener. */
-  if (--inode->open_cnt == 0)
-    {
-      /* Remove from inode list and release lock. */
-      list_remove (&inode->elem);
+  lock_acquire (&open_inodes_lock);
+  last = --inode->open_cnt == 0;
+  if (last)
+    hash_delete (&open_inodes, &inode->elem);
+  lock_release (&open_inodes_lock);
 
+  if (last)
+    {
       /* Deallocate blocks if removed. */
       if (inode->removed)
         {
+          size_t i;
+
+          journal_begin ();
+          for (i = 0; i < DIRECT_CNT; i++)
+            release_sectors (inode->data.direct[i], 0);
+          release_sectors (inode->data.indirect, 1);
+          release_sectors (inode->data.doubly_indirect, 2);
           free_map_release (inode->sector, 1);
-          free_map_release (inode->data.start,
-                            bytes_to_sectors (inode->data.length));
+          journal_end ();
         }
 
       free (inode);
@@ -194,6 +355,47 @@ inode_remove (struct inode *inode)
   inode->removed = true;
 }
 
+/* Called after a read of INODE from START up to END.  If the read
+   continues the previous one, grows the read-ahead window to 1,
+   3, 7, ... sectors, up to READ_AHEAD_MAX, and queues the sectors
+   past END that it now covers; otherwise read-ahead starts over.
+   Concurrent readers of one inode may race on these fields, but
+   they only steer read-ahead, so the worst case is a wasted or
+   missed prefetch. */
+static void
+read_ahead (struct inode *inode, off_t start, off_t end)
+{
+  off_t pos, limit;
+
+  if (start == inode->read_next)
+    {
+      inode->read_ahead_window = inode->read_ahead_window * 2 + 1;
+      if (inode->read_ahead_window > READ_AHEAD_MAX)
+        inode->read_ahead_window = READ_AHEAD_MAX;
+    }
+  else
+    {
+      inode->read_ahead_window = 0;
+      inode->read_ahead_end = 0;
+    }
+  inode->read_next = end;
+
+  pos = ROUND_UP (end, BLOCK_SECTOR_SIZE);
+  if (pos < inode->read_ahead_end)
+    pos = inode->read_ahead_end;
+  limit = pos + inode->read_ahead_window * BLOCK_SECTOR_SIZE;
+  if (limit > inode_length (inode))
+    limit = inode_length (inode);
+  for (; pos < limit; pos += BLOCK_SECTOR_SIZE)
+    {
+      block_sector_t sector = byte_to_sector (inode, pos, false);
+      if (sector != 0)
+        cache_read_ahead (sector);
+    }
+  if (pos > inode->read_ahead_end)
+    inode->read_ahead_end = pos;
+}
+
 /* Reads SIZE bytes from INODE into BUFFER, starting at position OFFSET.
    Returns the number of bytes actually read, which may be less
    than SIZE if an error occurs or end of file is reached. */
@@ -202,12 +404,11 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
 {
   uint8_t *buffer = buffer_;
   off_t bytes_read = 0;
-  uint8_t *bounce = NULL;
 
   while (size > 0)
     {
       /* Disk sector to read, starting byte offset within sector. */
-      block_sector_t sector_idx = byte_to_sector (inode, offset);
+      block_sector_t sector_idx = byte_to_sector (inode, offset, false);
       int sector_ofs = offset % BLOCK_SECTOR_SIZE;
 
       /* Bytes left in inode, bytes left in sector, lesser of the two. */
@@ -220,47 +421,53 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
       if (chunk_size <= 0)
         break;
 
-      if (sector_ofs == 0 && chunk_size == BLOCK_SECTOR_SIZE)
-        {
-          /* Read full sector directly into caller's buffer. */
-          block_read (fs_device, sector_idx, buffer + bytes_read);
-        }
+      if (sector_idx != 0)
+        cache_read_at (sector_idx, buffer + bytes_read, sector_ofs,
+                       chunk_size);
       else
-        {
-          /* Read sector into bounce buffer, then partially copy
-             into caller's buffer. */
-          if (bounce == NULL)
-            {
-              bounce = malloc (BLOCK_SECTOR_SIZE);
-              if (bounce == NULL)
-                break;
-            }
-          block_read (fs_device, sector_idx, bounce);
-          memcpy (buffer + bytes_read, bounce + sector_ofs, chunk_size);
-        }
+        memset (buffer + bytes_read, 0, chunk_size);
 
       /* Advance. */
       size -= chunk_size;
       offset += chunk_size;
       bytes_read += chunk_size;
     }
-  free (bounce);
+  read_ahead (inode, offset - bytes_read, offset);
 
   return bytes_read;
 }
 
+/* Writes the CNT data sectors in SECTORS to disk. */
+static void
+write_back (const block_sector_t sectors[], int cnt)
+{
+  int i;
+
+  for (i = 0; i < cnt; i++)
+    cache_write_back (sectors[i]);
+}
+
 /* Writes SIZE bytes from BUFFER into INODE, starting at OFFSET.
    Returns the number of bytes actually written, which may be
-   less than SIZE if end of file is reached or an error occurs.
-   (Normally a write at end of file would extend the inode, but
-   growth is not yet implemented.) */
+   less than SIZE if the disk fills up or an error occurs.
+   Writing past end of file extends the inode, allocating only
+   the sectors that are written.
+   Changes to metadata, including all writes to a journaled
+   inode, are made in journal transactions of up to WRITE_TXN_MAX
+   sectors of the write each, so a large write is not atomic.
+   Data sectors that a transaction allocates are written to disk
+   before it commits, so that once the transaction is replayed
+   they never hold another file's old contents. */
 off_t
 inode_write_at (struct inode *inode, const void *buffer_, off_t size,
                 off_t offset)
 {
   const uint8_t *buffer = buffer_;
   off_t bytes_written = 0;
-  uint8_t *bounce = NULL;
+  int txn_sectors = 0;
+  bool in_txn = false;
+  block_sector_t fresh[WRITE_TXN_MAX];  /* Allocated in this txn. */
+  int fresh_cnt = 0;
 
   if (inode->deny_write_cnt)
     return 0;
@@ -268,51 +475,74 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
   while (size > 0)
     {
       /* Sector to write, starting byte offset within sector. */
-      block_sector_t sector_idx = byte_to_sector (inode, offset);
+      block_sector_t sector_idx = byte_to_sector (inode, offset, false);
       int sector_ofs = offset % BLOCK_SECTOR_SIZE;
 
-      /* Bytes left in inode, bytes left in sector, lesser of the two. */
-      off_t inode_left = inode_length (inode) - offset;
-      int sector_left = BLOCK_SECTOR_SIZE - sector_ofs;
-      int min_left = inode_left < sector_left ? inode_left : sector_left;
-
       /* Number of bytes to actually write into this sector. */
-      int chunk_size = size < min_left ? size : min_left;
-      if (chunk_size <= 0)
-        break;
+      int sector_left = BLOCK_SECTOR_SIZE - sector_ofs;
+      int chunk_size = size < sector_left ? size : sector_left;
 
-      if (sector_ofs == 0 && chunk_size == BLOCK_SECTOR_SIZE)
+      if ((sector_idx == 0 || inode->journaled) && !in_txn)
         {
-          /* Write full sector directly to disk. */
-          block_write (fs_device, sector_idx, buffer + bytes_written);
+          journal_begin ();
+          in_txn = true;
         }
-      else
+
+      if (sector_idx == 0)
         {
-          /* We need a bounce buffer. */
-          if (bounce == NULL)
-            {
-              bounce = malloc (BLOCK_SECTOR_SIZE);
-              if (bounce == NULL)
-                break;
-            }
-
-          /* If the sector contains data before or after the chunk
-             we're writing, then we need to read in the sector
-             first.  Otherwise we start with a sector of all zeros. */
-          if (sector_ofs > 0 || chunk_size < sector_left)
-            block_read (fs_device, sector_idx, bounce);
-          else
-            memset (bounce, 0, BLOCK_SECTOR_SIZE);
-          memcpy (bounce + sector_ofs, buffer + bytes_written, chunk_size);
-          block_write (fs_device, sector_idx, bounce);
+          lock_acquire (&inode->lock);
+          sector_idx = byte_to_sector (inode, offset, true);
+          lock_release (&inode->lock);
+          if (sector_idx == 0)
+            break;
+          if (!inode->journaled)
+            fresh[fresh_cnt++] = sector_idx;
         }
 
+      if (inode->journaled)
+        journal_write_at (sector_idx, buffer + bytes_written, sector_ofs,
+                          chunk_size);
+      else
+        cache_write_at (sector_idx, buffer + bytes_written, sector_ofs,
+                        chunk_size);
+
       /* Advance. */
       size -= chunk_size;
       offset += chunk_size;
       bytes_written += chunk_size;
+
+      /* Commit every so often, to keep transactions small. */
+      if (in_txn && ++txn_sectors == WRITE_TXN_MAX)
+        {
+          write_back (fresh, fresh_cnt);
+          fresh_cnt = 0;
+          journal_end ();
+          in_txn = false;
+          txn_sectors = 0;
+        }
+    }
+
+  if (offset > inode->data.length)
+    {
+      if (!in_txn)
+        {
+          journal_begin ();
+          in_txn = true;
+        }
+      lock_acquire (&inode->lock);
+      if (offset > inode->data.length)
+        {
+          inode->data.length = offset;
+          journal_write_at (inode->sector, &inode->data, 0,
+                            BLOCK_SECTOR_SIZE);
+        }
+      lock_release (&inode->lock);
+    }
+  if (in_txn)
+    {
+      write_back (fresh, fresh_cnt);
+      journal_end ();
     }
-  free (bounce);
 
   return bytes_written;
 }
@@ -0,0 +1,323 @@
+#include "filesys/journal.h"
+#include <debug.h>
+#include <hash.h>
+#include <stdio.h>
+#include <string.h>
+#include "filesys/cache.h"
+#include "filesys/filesys.h"
+#include "filesys/free-map.h"
+#include "threads/synch.h"
+
+/* The journal is a write-ahead log of metadata sectors.
+
+   Each operation that changes metadata, such as creating or
+   removing a file or extending one, runs as a transaction between
+   journal_begin() and journal_end().  The sectors it changes are
+   held in the buffer cache until the transaction commits, which
+   appends their new contents to the log, after a header that says
+   where they belong, in a single write.  After that the sectors
+   reach their own places on disk whenever the cache writes them
+   back.
+
+   A checkpoint writes back every dirty sector and then empties
+   the log by recording a new starting sequence number in the
+   journal's first sector.  At startup, journal_open() replays the
+   committed transactions still in the log, in order, redoing any
+   of their writes that had not reached the disk. */
+
+/* Identify the journal's first sector and transaction headers. */
+#define JOURNAL_MAGIC 0x4a524e4c
+#define TXN_MAGIC 0x54584e48
+
+/* Maximum number of sectors one transaction may change. */
+#define TXN_MAX 31
+
+/* The log takes up the journal after its first sector. */
+#define LOG_START (JOURNAL_SECTOR + 1)
+#define LOG_SIZE (JOURNAL_SIZE - 1)
+
+/* First sector of the journal.
+   Must be exactly BLOCK_SECTOR_SIZE bytes long. */
+struct journal_super
+  {
+    unsigned magic;                     /* JOURNAL_MAGIC. */
+    uint32_t seq;                       /* Sequence number of the first
+                                           transaction in the log. */
+    uint8_t unused[BLOCK_SECTOR_SIZE - 8];
+  };
+
+/* Header of a transaction in the log, which is followed by the
+   new contents of SECTORS[0] through SECTORS[CNT - 1].
+   Must be exactly BLOCK_SECTOR_SIZE bytes long. */
+struct txn_header
+  {
+    unsigned magic;                     /* TXN_MAGIC. */
+    uint32_t seq;                       /* Sequence number. */
+    uint32_t cnt;                       /* Number of sectors. */
+    unsigned checksum;                  /* hash_bytes() of contents. */
+    block_sector_t sectors[TXN_MAX];    /* Where the contents belong. */
+    uint8_t unused[BLOCK_SECTOR_SIZE - 16
+                   - TXN_MAX * sizeof (block_sector_t)];
+  };
+
+/* The running transaction, laid out as it is written to the log.
+   Its header lists the sectors changed so far; their contents
+   are gathered from the cache only when it commits. */
+static struct
+  {
+    struct txn_header header;
+    uint8_t data[TXN_MAX][BLOCK_SECTOR_SIZE];
+  }
+txn;
+
+static struct lock journal_lock;        /* Held throughout a transaction. */
+static int depth;                       /* Nesting of journal_begin(). */
+static bool active;                     /* Between open and close? */
+static uint32_t next_seq;               /* Next transaction's number. */
+static size_t log_used;                 /* Log sectors in use. */
+
+/* Sectors that have images in the log or in the running
+   transaction.  There can be no more of them than the log has
+   room for. */
+static block_sector_t logged[LOG_SIZE];
+static size_t logged_cnt;
+
+/* Initializes the journal module. */
+void
+journal_init (void)
+{
+  lock_init (&journal_lock);
+}
+
+/* Writes the journal's first sector, saying that the log starts
+   with transaction SEQ. */
+static void
+write_super (uint32_t seq)
+{
+  struct journal_super super;
+
+  ASSERT (sizeof super == BLOCK_SECTOR_SIZE);
+
+  memset (&super, 0, sizeof super);
+  super.magic = JOURNAL_MAGIC;
+  super.seq = seq;
+  block_write (fs_device, JOURNAL_SECTOR, &super);
+}
+
+/* Creates an empty journal on a newly formatted file system.
+   The first log sector is zeroed, so that nothing left over from
+   an earlier file system can pass for a transaction. */
+void
+journal_create (void)
+{
+  static const uint8_t zeros[BLOCK_SECTOR_SIZE];
+
+  block_write (fs_device, LOG_START, zeros);
+  write_super (1);
+}
+
+/* Reads the transaction at log position POS into TXN.  Returns
+   true if it is the transaction numbered NEXT_SEQ and was
+   completely written, false otherwise. */
+static bool
+read_txn (size_t pos)
+{
+  struct txn_header *h = &txn.header;
+
+  ASSERT (sizeof *h == BLOCK_SECTOR_SIZE);
+
+  if (pos >= LOG_SIZE)
+    return false;
+  block_read (fs_device, LOG_START + pos, h);
+  if (h->magic != TXN_MAGIC || h->seq != next_seq
+      || h->cnt == 0 || h->cnt > TXN_MAX || pos + 1 + h->cnt > LOG_SIZE)
+    return false;
+  block_read_multiple (fs_device, LOG_START + pos + 1, h->cnt, txn.data);
+  return hash_bytes (txn.data, h->cnt * BLOCK_SECTOR_SIZE) == h->checksum;
+}
+
+/* Writes back every dirty sector that is not part of a running
+   transaction and, if the log is not empty, empties it and makes
+   the sectors whose release waited for that available.  The
+   caller must hold journal_lock, outside any transaction. */
+static void
+checkpoint (void)
+{
+  cache_flush ();
+  if (active && log_used > 0)
+    {
+      write_super (next_seq);
+      log_used = 0;
+      logged_cnt = 0;
+      free_map_reclaim ();
+    }
+}
+
+/* Opens the journal, replaying the transactions committed to it
+   since the last checkpoint.  Must be called before anything
+   else reads the file system. */
+void
+journal_open (void)
+{
+  struct journal_super super;
+  size_t pos = 0;
+  int replayed = 0;
+
+  block_read (fs_device, JOURNAL_SECTOR, &super);
+  if (super.magic != JOURNAL_MAGIC)
+    PANIC ("journal not found--reformat the file system");
+
+  next_seq = super.seq;
+  while (read_txn (pos))
+    {
+      size_t i;
+
+      for (i = 0; i < txn.header.cnt; i++)
+        cache_write_at (txn.header.sectors[i], txn.data[i], 0,
+                        BLOCK_SECTOR_SIZE);
+      pos += 1 + txn.header.cnt;
+      next_seq++;
+      replayed++;
+    }
+  if (replayed > 0)
+    printf ("journal: replayed %d transactions\n", replayed);
+
+  lock_acquire (&journal_lock);
+  active = true;
+  log_used = pos;
+  checkpoint ();
+  lock_release (&journal_lock);
+}
+
+/* Checkpoints the journal and closes it. */
+void
+journal_close (void)
+{
+  lock_acquire (&journal_lock);
+  checkpoint ();
+  active = false;
+  lock_release (&journal_lock);
+}
+
+/* Begins a transaction, or, if the current thread is already in
+   one, a nested part of it that commits with the outermost
+   transaction.  Transactions run one at a time.  Until the
+   journal is opened, this does nothing. */
+void
+journal_begin (void)
+{
+  if (!active)
+    return;
+  if (lock_held_by_current_thread (&journal_lock))
+    {
+      depth++;
+      return;
+    }
+
+  lock_acquire (&journal_lock);
+  depth = 1;
+  txn.header.cnt = 0;
+  if (log_used + 1 + TXN_MAX > LOG_SIZE)
+    checkpoint ();
+}
+
+/* Commits the running transaction with a single write to the
+   log, then lets the cache write its sectors back. */
+static void
+commit (void)
+{
+  struct txn_header *h = &txn.header;
+  size_t i;
+
+  if (h->cnt == 0)
+    return;
+
+  for (i = 0; i < h->cnt; i++)
+    cache_read_at (h->sectors[i], txn.data[i], 0, BLOCK_SECTOR_SIZE);
+  h->magic = TXN_MAGIC;
+  h->seq = next_seq++;
+  h->checksum = hash_bytes (txn.data, h->cnt * BLOCK_SECTOR_SIZE);
+  block_write_multiple (fs_device, LOG_START + log_used, 1 + h->cnt, &txn);
+  log_used += 1 + h->cnt;
+
+  for (i = 0; i < h->cnt; i++)
+    cache_release (h->sectors[i]);
+  h->cnt = 0;
+}
+
+/* Ends the transaction begun by the matching journal_begin().
+   Ending the outermost one writes out the free map's changes as
+   part of it and commits it. */
+void
+journal_end (void)
+{
+  if (!active)
+    return;
+
+  ASSERT (lock_held_by_current_thread (&journal_lock));
+  if (depth == 1)
+    {
+      free_map_flush ();
+      commit ();
+    }
+  if (--depth == 0)
+    lock_release (&journal_lock);
+}
+
+/* Copies SIZE bytes from BUFFER to OFFSET within metadata sector
+   SECTOR, as part of the running transaction.  Until the journal
+   is opened, this is the same as cache_write_at(). */
+void
+journal_write_at (block_sector_t sector, const void *buffer,
+                  int offset, int size)
+{
+  struct txn_header *h = &txn.header;
+  size_t i;
+
+  if (!active)
+    {
+      cache_write_at (sector, buffer, offset, size);
+      return;
+    }
+
+  ASSERT (lock_held_by_current_thread (&journal_lock));
+  for (i = 0; i < h->cnt; i++)
+    if (h->sectors[i] == sector)
+      break;
+  if (i == h->cnt)
+    {
+      if (h->cnt == TXN_MAX)
+        PANIC ("journal: transaction changes too many sectors");
+      if (!journal_logged (sector))
+        logged[logged_cnt++] = sector;
+      h->sectors[h->cnt++] = sector;
+    }
+  cache_write_held (sector, buffer, offset, size);
+}
+
+/* Returns true if replaying the journal could overwrite SECTOR,
+   because the log or the running transaction has an image of
+   it. */
+bool
+journal_logged (block_sector_t sector)
+{
+  size_t i;
+
+  if (!active)
+    return false;
+  for (i = 0; i < logged_cnt; i++)
+    if (logged[i] == sector)
+      return true;
+  return false;
+}
+
+/* Checkpoints the journal, waiting for any running transaction
+   to finish first.  Before the journal is opened, just writes
+   back dirty sectors. */
+void
+journal_checkpoint (void)
+{
+  lock_acquire (&journal_lock);
+  checkpoint ();
+  lock_release (&journal_lock);
+}
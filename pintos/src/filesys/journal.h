@@ -0,0 +1,18 @@
+#ifndef FILESYS_JOURNAL_H
+#define FILESYS_JOURNAL_H
+
+#include <stdbool.h>
+#include "devices/block.h"
+
+void journal_init (void);
+void journal_create (void);
+void journal_open (void);
+void journal_close (void);
+
+void journal_begin (void);
+void journal_end (void);
+void journal_write_at (block_sector_t, const void *, int offset, int size);
+bool journal_logged (block_sector_t);
+void journal_checkpoint (void);
+
+#endif /* filesys/journal.h */
@@ -245,21 +245,43 @@ bitmap_count (const struct bitmap *b, size_t start, size_t cnt, bool value)
   return value_cnt;
 }
 
+/* Returns the index of the first bit in B at or after START, and
+   before END, that is set to VALUE, or END if there is none.
+   Whole elements that hold no such bit are skipped at once. */
+static size_t
+find_bit (const struct bitmap *b, size_t start, size_t end, bool value)
+{
+  elem_type flip = value ? 0 : (elem_type) -1;
+  size_t last = elem_cnt (end);
+  size_t i = elem_idx (start);
+  elem_type elem;
+
+  if (start >= end)
+    return end;
+
+  /* Turn the bits we are looking for into 1s, dropping the bits
+     before START. */
+  elem = (b->bits[i] ^ flip) & ((elem_type) -1 << (start % ELEM_BITS));
+  while (elem == 0)
+    {
+      if (++i >= last)
+        return end;
+      elem = b->bits[i] ^ flip;
+    }
+  start = i * ELEM_BITS + __builtin_ctzl (elem);
+  return start < end ? start : end;
+}
+
 /* Returns true if any bits in B between START and START + CNT,
    exclusive, are set to VALUE, and false otherwise. */
 bool
 bitmap_contains (const struct bitmap *b, size_t start, size_t cnt, bool value)
 {
-  size_t i;
-
   ASSERT (b != NULL);
   ASSERT (start <= b->bit_cnt);
   ASSERT (start + cnt <= b->bit_cnt);
 
-  for (i = 0; i < cnt; i++)
-    if (bitmap_test (b, start + i) == value)
-      return true;
-  return false;
+  return find_bit (b, start, start + cnt, value) < start + cnt;
 }
 
 /* Returns true if any bits in B between START and START + CNT,
@@ -298,13 +320,22 @@ bitmap_scan (const struct bitmap *b, size_t start, size_t cnt, bool value)
   ASSERT (b != NULL);
   ASSERT (start <= b->bit_cnt);
 
-  if (cnt <= b->bit_cnt)
+  if (cnt == 0)
+    return start;
+  while (cnt <= b->bit_cnt - start)
     {
-      size_t last = b->bit_cnt - cnt;
-      size_t i;
-      for (i = start; i <= last; i++)
-        if (!bitmap_contains (b, i, cnt, !value))
-          return i;
+      /* Find the next bit set to VALUE, then the end of the run
+         of VALUE bits that starts there.  If the run is too
+         short, nothing before its end can start a group either. */
+      size_t end;
+
+      start = find_bit (b, start, b->bit_cnt, value);
+      if (start == b->bit_cnt || cnt > b->bit_cnt - start)
+        break;
+      end = find_bit (b, start, start + cnt, !value);
+      if (end == start + cnt)
+        return start;
+      start = end;
     }
   return BITMAP_ERROR;
 }
@@ -358,6 +389,22 @@ bitmap_write (const struct bitmap *b, struct file *file)
   off_t size = byte_cnt (b->bit_cnt);
   return file_write_at (file, b->bits, size, 0) == size;
 }
+
+/* Writes the bytes of B's file image that start at offset OFS,
+   up to SIZE of them, to the same place in FILE.  Return true if
+   successful, false otherwise. */
+bool
+bitmap_write_part (const struct bitmap *b, struct file *file,
+                   size_t ofs, size_t size)
+{
+  size_t total = byte_cnt (b->bit_cnt);
+  if (ofs >= total)
+    return true;
+  if (size > total - ofs)
+    size = total - ofs;
+  return (file_write_at (file, (const uint8_t *) b->bits + ofs, size, ofs)
+          == (off_t) size);
+}
 #endif /* FILESYS */
 
 /* Debugging. */
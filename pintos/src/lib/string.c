@@ -1,5 +1,35 @@
 #include <string.h>
 #include <debug.h>
+#include <stdint.h>
+
+/* memcpy(), memmove() and memset() work a word at a time on
+   blocks of at least this many bytes.  Shorter blocks are not
+   worth aligning. */
+#define WORD_MIN_SIZE 16
+
+/* A 32-bit word that may alias any other type. */
+typedef uint32_t __attribute__ ((__may_alias__)) word_t;
+
+/* Copies SIZE bytes upward from SRC to DST.  Aligns DST to a
+   word, moves whole words with `rep movsl', then the tail.  Safe
+   for overlapping blocks as long as DST is below SRC. */
+static void
+copy_up (unsigned char *dst, const unsigned char *src, size_t size)
+{
+  if (size >= WORD_MIN_SIZE)
+    {
+      size_t head = -(uintptr_t) dst & 3;
+      size_t words = (size - head) / 4;
+
+      size = (size - head) & 3;
+      asm volatile ("rep movsb"
+                    : "+D" (dst), "+S" (src), "+c" (head) : : "memory");
+      asm volatile ("rep movsl"
+                    : "+D" (dst), "+S" (src), "+c" (words) : : "memory");
+    }
+  asm volatile ("rep movsb"
+                : "+D" (dst), "+S" (src), "+c" (size) : : "memory");
+}
 
 /* Copies SIZE bytes from SRC to DST, which must not overlap.
    Returns DST. */
@@ -12,8 +42,7 @@ memcpy (void *dst_, const void *src_, size_t size)
   ASSERT (dst != NULL || size == 0);
   ASSERT (src != NULL || size == 0);
 
-  while (size-- > 0)
-    *dst++ = *src++;
+  copy_up (dst, src, size);
 
   return dst_;
 }
@@ -29,20 +58,31 @@ memmove (void *dst_, const void *src_, size_t size)
   ASSERT (dst != NULL || size == 0);
   ASSERT (src != NULL || size == 0);
 
-  if (dst < src)
-    {
-      while (size-- > 0)
-        *dst++ = *src++;
-    }
+  if (dst <= src || dst >= src + size)
+    copy_up (dst, src, size);
   else
     {
-      dst += size;
-      src += size;
-      while (size-- > 0)
-        *--dst = *--src;
+      /* Copy downward from the end: first the odd bytes, so that
+         the rest is whole words, then the words with the
+         direction flag set.  Interrupt handlers clear the flag
+         for themselves and restore ours on return. */
+      size_t words = size / 4;
+
+      while (size % 4 != 0)
+        {
+          size--;
+          dst[size] = src[size];
+        }
+      if (words > 0)
+        {
+          dst += size - 4;
+          src += size - 4;
+          asm volatile ("std; rep movsl; cld"
+                        : "+D" (dst), "+S" (src), "+c" (words) : : "memory");
+        }
     }
 
-  return dst;
+  return dst_;
 }
 
 /* Find the first differing byte in the two blocks of SIZE bytes
@@ -58,6 +98,10 @@ memcmp (const void *a_, const void *b_, size_t size)
   ASSERT (a != NULL || size == 0);
   ASSERT (b != NULL || size == 0);
 
+  /* Skip equal words, then find the differing byte. */
+  for (; size >= 4; a += 4, b += 4, size -= 4)
+    if (*(const word_t *) a != *(const word_t *) b)
+      break;
   for (; size-- > 0; a++, b++)
     if (*a != *b)
       return *a > *b ? +1 : -1;
@@ -282,8 +326,20 @@ memset (void *dst_, int value, size_t size)
 
   ASSERT (dst != NULL || size == 0);
 
-  while (size-- > 0)
-    *dst++ = value;
+  if (size >= WORD_MIN_SIZE)
+    {
+      size_t head = -(uintptr_t) dst & 3;
+      size_t words = (size - head) / 4;
+      uint32_t pattern = (unsigned char) value * 0x01010101u;
+
+      size = (size - head) & 3;
+      asm volatile ("rep stosb"
+                    : "+D" (dst), "+c" (head) : "a" (value) : "memory");
+      asm volatile ("rep stosl"
+                    : "+D" (dst), "+c" (words) : "a" (pattern) : "memory");
+    }
+  asm volatile ("rep stosb"
+                : "+D" (dst), "+c" (size) : "a" (value) : "memory");
 
   return dst_;
 }
@@ -373,3 +429,77 @@ strlcat (char *dst, const char *src, size_t size)
   return src_len + dst_len;
 }
 
+/* Byte-at-a-time versions of the routines above, for testing
+   and comparison. */
+
+/* Like memcpy(), one byte at a time. */
+void *
+memcpy_bytes (void *dst_, const void *src_, size_t size)
+{
+  unsigned char *dst = dst_;
+  const unsigned char *src = src_;
+
+  ASSERT (dst != NULL || size == 0);
+  ASSERT (src != NULL || size == 0);
+
+  while (size-- > 0)
+    *dst++ = *src++;
+
+  return dst_;
+}
+
+/* Like memmove(), one byte at a time. */
+void *
+memmove_bytes (void *dst_, const void *src_, size_t size)
+{
+  unsigned char *dst = dst_;
+  const unsigned char *src = src_;
+
+  ASSERT (dst != NULL || size == 0);
+  ASSERT (src != NULL || size == 0);
+
+  if (dst < src)
+    {
+      while (size-- > 0)
+        *dst++ = *src++;
+    }
+  else
+    {
+      dst += size;
+      src += size;
+      while (size-- > 0)
+        *--dst = *--src;
+    }
+
+  return dst_;
+}
+
+/* Like memset(), one byte at a time. */
+void *
+memset_bytes (void *dst_, int value, size_t size)
+{
+  unsigned char *dst = dst_;
+
+  ASSERT (dst != NULL || size == 0);
+
+  while (size-- > 0)
+    *dst++ = value;
+
+  return dst_;
+}
+
+/* Like memcmp(), one byte at a time. */
+int
+memcmp_bytes (const void *a_, const void *b_, size_t size)
+{
+  const unsigned char *a = a_;
+  const unsigned char *b = b_;
+
+  ASSERT (a != NULL || size == 0);
+  ASSERT (b != NULL || size == 0);
+
+  for (; size-- > 0; a++, b++)
+    if (*a != *b)
+      return *a > *b ? +1 : -1;
+  return 0;
+}
@@ -25,6 +25,12 @@ size_t strlcat (char *, const char *, size_t);
 char *strtok_r (char *, const char *, char **);
 size_t strnlen (const char *, size_t);
 
+/* Byte-at-a-time mem*() functions, for testing. */
+void *memcpy_bytes (void *, const void *, size_t);
+void *memmove_bytes (void *, const void *, size_t);
+void *memset_bytes (void *, int, size_t);
+int memcmp_bytes (const void *, const void *, size_t);
+
 /* Try to be helpful. */
 #define strcpy dont_use_strcpy_use_strlcpy
 #define strncpy dont_use_strncpy_use_strlcpy
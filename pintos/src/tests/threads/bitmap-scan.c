@@ -0,0 +1,129 @@
+/* Checks bitmap_scan() against a bit-at-a-time reference scan on
+   random bitmaps, then reports how many CPU cycles each takes per
+   scan when they are used to carve runs of various lengths out of
+   a large, fragmented bitmap.  The cycle counts are printed for
+   information only. */
+
+#include <bitmap.h>
+#include <debug.h>
+#include <random.h>
+#include <stdint.h>
+#include "tests/threads/tests.h"
+
+/* Size of the bitmap used for timing. */
+#define BIG_BITS (128 * 1024)
+
+/* Allocations timed for each run length. */
+#define ALLOCATIONS 64
+
+/* The bitmap_scan() algorithm that tests every bit of every
+   candidate group. */
+static size_t
+reference_scan (const struct bitmap *b, size_t start, size_t cnt, bool value)
+{
+  size_t i, j;
+
+  for (i = start; i + cnt <= bitmap_size (b); i++)
+    {
+      for (j = 0; j < cnt; j++)
+        if (bitmap_test (b, i + j) != value)
+          break;
+      if (j == cnt)
+        return i;
+    }
+  return BITMAP_ERROR;
+}
+
+/* Marks most of B in use, leaving one free run of random length
+   below 32 at a random place in every 128 bits. */
+static void
+fragment (struct bitmap *b)
+{
+  size_t i;
+
+  bitmap_set_all (b, true);
+  for (i = 0; i + 128 <= bitmap_size (b); i += 128)
+    {
+      size_t len = random_ulong () % 32;
+      bitmap_set_multiple (b, i + random_ulong () % (128 - len), len, false);
+    }
+}
+
+/* Compares bitmap_scan() with reference_scan() on random bitmaps
+   of every size up to 200 bits, with both sparse and dense bits. */
+static void
+check_results (void)
+{
+  size_t bit_cnt, start, cnt, i;
+  int density;
+
+  for (bit_cnt = 0; bit_cnt < 200; bit_cnt += 7)
+    for (density = 1; density < 8; density += 3)
+      {
+        struct bitmap *b = bitmap_create (bit_cnt);
+        ASSERT (b != NULL);
+        for (i = 0; i < bit_cnt; i++)
+          bitmap_set (b, i, (int) (random_ulong () % 8) < density);
+
+        for (start = 0; start <= bit_cnt; start += 3)
+          for (cnt = 0; cnt < 12; cnt++)
+            {
+              bool value = cnt % 2;
+              size_t expected = reference_scan (b, start, cnt, value);
+              size_t actual = bitmap_scan (b, start, cnt, value);
+              if (actual != expected)
+                fail ("scan of %zu bits for %zu %d's from %zu: "
+                      "got %zu, expected %zu",
+                      bit_cnt, cnt, value, start, actual, expected);
+            }
+        bitmap_destroy (b);
+      }
+}
+
+/* Returns the average cycles per scan over up to ALLOCATIONS
+   allocations of CNT bits from a freshly fragmented B, stopping
+   after the first scan that finds no room.  Uses the
+   word-parallel scan if FAST is true and the reference scan
+   otherwise. */
+static uint64_t
+time_allocations (struct bitmap *b, size_t cnt, bool fast)
+{
+  uint64_t total = 0;
+  int scans = 0;
+
+  random_init (cnt);
+  fragment (b);
+  while (scans < ALLOCATIONS)
+    {
+      uint64_t start = cycle_count ();
+      size_t idx = (fast
+                    ? bitmap_scan (b, 0, cnt, false)
+                    : reference_scan (b, 0, cnt, false));
+      total += cycle_count () - start;
+      scans++;
+      if (idx == BITMAP_ERROR)
+        break;
+      bitmap_set_multiple (b, idx, cnt, true);
+    }
+  return total / scans;
+}
+
+void
+test_bitmap_scan (void)
+{
+  static const size_t cnts[] = {1, 4, 16, 30};
+  struct bitmap *b;
+  size_t i;
+
+  check_results ();
+  msg ("bitmap_scan() agrees with the reference scan.");
+
+  b = bitmap_create (BIG_BITS);
+  ASSERT (b != NULL);
+  for (i = 0; i < sizeof cnts / sizeof *cnts; i++)
+    msg ("timing: %zu-bit allocations: %llu cycles per scan "
+         "(reference: %llu cycles)",
+         cnts[i], (unsigned long long) time_allocations (b, cnts[i], true),
+         (unsigned long long) time_allocations (b, cnts[i], false));
+  bitmap_destroy (b);
+}
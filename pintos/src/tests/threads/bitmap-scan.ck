@@ -0,0 +1,11 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+use tests::threads::timing;
+check_timed ([<<'EOF']);
+(bitmap-scan) begin
+(bitmap-scan) bitmap_scan() agrees with the reference scan.
+(bitmap-scan) end
+EOF
+pass;
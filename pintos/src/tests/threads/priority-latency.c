@@ -0,0 +1,147 @@
+/* Hands the CPU back and forth between two threads, first with
+   nothing else ready to run and then with many lower-priority
+   threads ready, and checks that the higher-priority partner
+   always runs as soon as it is woken, before any of the
+   lower-priority threads.  Then lowers our own priority and
+   checks that the lower-priority threads run highest first.
+
+   Each round, the main thread ups a semaphore that wakes a
+   higher-priority partner, which preempts it, ups a second
+   semaphore and blocks again, letting the main thread continue.
+
+   The number of rounds completed in a fixed number of ticks is
+   printed for information only: with a run queue per priority it
+   should not drop much when the other threads are ready, but how
+   much it varies depends on the host. */
+
+#include <stdio.h>
+#include "tests/threads/tests.h"
+#include "threads/init.h"
+#include "threads/interrupt.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "devices/timer.h"
+
+/* Ticks to run each measurement for. */
+#define MEASURE_TICKS 50
+
+/* Lower-priority threads kept ready during the second measurement. */
+#define FILLER_CNT 48
+
+struct ping_pong
+  {
+    struct semaphore ping;
+    struct semaphore pong;
+    long long rounds;           /* Rounds the partner has run. */
+    bool done;
+  };
+
+/* Priorities of the fillers, in the order they ran. */
+static int filler_order[FILLER_CNT];
+static int filler_cnt;
+
+static thread_func partner_thread;
+static thread_func filler_thread;
+static long long measure_rounds (struct ping_pong *);
+
+void
+test_priority_latency (void)
+{
+  struct ping_pong pp;
+  long long quiet, loaded;
+  int i;
+
+  /* This test does not work with the MLFQS. */
+  ASSERT (!thread_mlfqs);
+
+  sema_init (&pp.ping, 0);
+  sema_init (&pp.pong, 0);
+  pp.rounds = 0;
+  pp.done = false;
+  thread_set_priority (PRI_MAX - 1);
+  thread_create ("partner", PRI_MAX, partner_thread, &pp);
+
+  quiet = measure_rounds (&pp);
+  msg ("Partner ran as soon as it was woken, with no other thread ready.");
+
+  /* The fillers stay ready, but must not run while we are
+     running. */
+  filler_cnt = 0;
+  for (i = 0; i < FILLER_CNT; i++)
+    {
+      char name[16];
+      snprintf (name, sizeof name, "filler %d", i);
+      thread_create (name, PRI_MIN + 1 + i % (PRI_MAX - 2), filler_thread, NULL);
+    }
+  loaded = measure_rounds (&pp);
+  if (filler_cnt != 0)
+    fail ("a lower-priority thread ran before we lowered our priority");
+  msg ("Partner ran as soon as it was woken, with %d other threads ready.",
+       FILLER_CNT);
+
+  msg ("timing: %lld rounds in %d ticks with no other thread ready.",
+       quiet, MEASURE_TICKS);
+  msg ("timing: %lld rounds in %d ticks with %d other threads ready.",
+       loaded, MEASURE_TICKS, FILLER_CNT);
+
+  /* Stop the partner, then let the fillers run and exit. */
+  pp.done = true;
+  sema_up (&pp.ping);
+  thread_set_priority (PRI_MIN);
+  thread_set_priority (PRI_DEFAULT);
+
+  if (filler_cnt != FILLER_CNT)
+    fail ("only %d of %d lower-priority threads ran", filler_cnt, FILLER_CNT);
+  for (i = 1; i < FILLER_CNT; i++)
+    if (filler_order[i] > filler_order[i - 1])
+      fail ("priority %d thread ran after priority %d thread",
+            filler_order[i], filler_order[i - 1]);
+  msg ("Lower-priority threads ran highest priority first.");
+}
+
+/* Returns the number of ping-pong rounds completed in
+   MEASURE_TICKS timer ticks, starting at a tick boundary.  Fails
+   if the partner did not run as soon as it was woken. */
+static long long
+measure_rounds (struct ping_pong *pp)
+{
+  long long rounds = 0;
+  int64_t start = timer_ticks ();
+
+  while (timer_ticks () == start)
+    continue;
+  start = timer_ticks ();
+  pp->rounds = 0;
+  while (timer_elapsed (start) < MEASURE_TICKS)
+    {
+      sema_up (&pp->ping);
+      if (pp->rounds != rounds + 1)
+        fail ("partner did not preempt us in round %lld", rounds);
+      sema_down (&pp->pong);
+      rounds++;
+    }
+  return rounds;
+}
+
+static void
+partner_thread (void *pp_)
+{
+  struct ping_pong *pp = pp_;
+
+  for (;;)
+    {
+      sema_down (&pp->ping);
+      if (pp->done)
+        break;
+      pp->rounds++;
+      sema_up (&pp->pong);
+    }
+}
+
+static void
+filler_thread (void *aux UNUSED)
+{
+  enum intr_level old_level = intr_disable ();
+  filler_order[filler_cnt++] = thread_get_priority ();
+  intr_set_level (old_level);
+}
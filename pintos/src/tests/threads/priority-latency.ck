@@ -0,0 +1,13 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+use tests::threads::timing;
+check_timed ([<<'EOF']);
+(priority-latency) begin
+(priority-latency) Partner ran as soon as it was woken, with no other thread ready.
+(priority-latency) Partner ran as soon as it was woken, with 48 other threads ready.
+(priority-latency) Lower-priority threads ran highest priority first.
+(priority-latency) end
+EOF
+pass;
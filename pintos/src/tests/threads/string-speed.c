@@ -0,0 +1,263 @@
+/* Checks that memcpy(), memmove(), memset() and memcmp() give
+   the right results for a range of sizes, alignments and
+   overlaps, then reports how many CPU cycles they and their
+   byte-at-a-time versions take per kB on page-sized blocks.
+
+   The expected results are worked out from the test pattern
+   itself, not with other routines from lib/string.c, so a bug
+   shared by a routine and its byte version is caught too.  The
+   cycle counts are informational only. */
+
+#include <stdint.h>
+#include <string.h>
+#include "tests/threads/tests.h"
+#include "threads/palloc.h"
+#include "threads/vaddr.h"
+
+/* Timed repetitions of each routine; the fastest one counts. */
+#define ITERATIONS 64
+
+/* Bytes around each checked block that must be left alone. */
+#define GUARD 8
+
+/* Bytes of each page used for checking, enough for the largest
+   size at the largest offset. */
+#define CHECK_SIZE 2048
+
+/* Block sizes to check: every size around the word-at-a-time
+   threshold and the word size, and some larger ones. */
+static const size_t sizes[] =
+  {
+    0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 12, 15, 16, 17, 18, 19, 20, 21,
+    31, 32, 33, 63, 64, 65, 100, 255, 256, 257, 1000, 1023, 1024,
+  };
+
+/* Distances between overlapping memmove() sources and
+   destinations. */
+static const int shifts[] =
+  {
+    -257, -64, -9, -8, -7, -6, -5, -4, -3, -2, -1,
+    1, 2, 3, 4, 5, 6, 7, 8, 9, 64, 257,
+  };
+
+#define ARRAY_CNT(A) (sizeof (A) / sizeof *(A))
+
+/* Byte I of the pattern numbered SEED. */
+static uint8_t
+pattern (size_t i, unsigned seed)
+{
+  return (i * 7 + (i >> 8) * 3 + seed * 13 + 1) & 0xff;
+}
+
+/* Fills BUF[0..SIZE) with pattern SEED. */
+static void
+fill (uint8_t *buf, size_t size, unsigned seed)
+{
+  size_t i;
+
+  for (i = 0; i < size; i++)
+    buf[i] = pattern (i, seed);
+}
+
+/* Checks that BUF[0..SIZE) still holds pattern SEED everywhere
+   except BUF[OFS..OFS + CNT), which must hold pattern
+   SRC_SEED's bytes from SRC_OFS on, or VALUE if SRC_SEED is
+   negative.  WHAT names the routine, for failure messages. */
+static void
+check (const char *what, const uint8_t *buf, size_t size, unsigned seed,
+       size_t ofs, size_t cnt, int src_seed, size_t src_ofs, uint8_t value)
+{
+  size_t lo = ofs >= GUARD ? ofs - GUARD : 0;
+  size_t hi = ofs + cnt + GUARD <= size ? ofs + cnt + GUARD : size;
+  size_t i;
+
+  for (i = lo; i < hi; i++)
+    {
+      uint8_t expected;
+
+      if (i < ofs || i >= ofs + cnt)
+        expected = pattern (i, seed);
+      else if (src_seed >= 0)
+        expected = pattern (src_ofs + (i - ofs), src_seed);
+      else
+        expected = value;
+      if (buf[i] != expected)
+        fail ("%s of %zu bytes to offset %zu: byte %zu is %d, expected %d",
+              what, cnt, ofs, i, buf[i], expected);
+    }
+}
+
+/* Returns -1, 0 or 1 according to the sign of X. */
+static int
+sign (int x)
+{
+  return (x > 0) - (x < 0);
+}
+
+/* Checks memcpy() and memset() at every alignment of source and
+   destination. */
+static void
+check_copy_set (uint8_t *dst, uint8_t *src, size_t size)
+{
+  size_t s, src_ofs, dst_ofs;
+
+  for (s = 0; s < ARRAY_CNT (sizes); s++)
+    for (src_ofs = GUARD; src_ofs < GUARD + 4; src_ofs++)
+      for (dst_ofs = GUARD; dst_ofs < GUARD + 4; dst_ofs++)
+        {
+          size_t cnt = sizes[s];
+
+          fill (src, size, 1);
+          fill (dst, size, 2);
+          if (memcpy (dst + dst_ofs, src + src_ofs, cnt) != dst + dst_ofs)
+            fail ("memcpy returned the wrong pointer");
+          check ("memcpy", dst, size, 2, dst_ofs, cnt, 1, src_ofs, 0);
+
+          /* Values are converted to unsigned char. */
+          fill (dst, size, 2);
+          if (memset (dst + dst_ofs, 0x100 | (0x80 + cnt), cnt)
+              != dst + dst_ofs)
+            fail ("memset returned the wrong pointer");
+          check ("memset", dst, size, 2, dst_ofs, cnt, -1, 0, 0x80 + cnt);
+        }
+}
+
+/* Checks memmove() between overlapping blocks, in both
+   directions, at every alignment of the destination. */
+static void
+check_move (uint8_t *buf, size_t size)
+{
+  size_t s, t, dst_ofs;
+
+  for (s = 0; s < ARRAY_CNT (sizes); s++)
+    for (t = 0; t < ARRAY_CNT (shifts); t++)
+      for (dst_ofs = 300; dst_ofs < 304; dst_ofs++)
+        {
+          size_t cnt = sizes[s];
+          size_t src_ofs = dst_ofs + shifts[t];
+
+          fill (buf, size, 3);
+          if (memmove (buf + dst_ofs, buf + src_ofs, cnt) != buf + dst_ofs)
+            fail ("memmove returned the wrong pointer");
+          check ("memmove", buf, size, 3, dst_ofs, cnt, 3, src_ofs, 0);
+        }
+}
+
+/* Checks that memcmp() finds a difference at the start, the
+   end, or anywhere in small blocks, with the sign that an
+   unsigned byte comparison gives. */
+static void
+check_compare (uint8_t *a, uint8_t *b, size_t size)
+{
+  size_t s, ofs, pos;
+
+  for (s = 0; s < ARRAY_CNT (sizes); s++)
+    for (ofs = 0; ofs < 4; ofs++)
+      {
+        size_t cnt = sizes[s];
+
+        fill (a, size, 4);
+        fill (b, size, 4);
+        if (memcmp (a + ofs, b + ofs, cnt) != 0)
+          fail ("memcmp of %zu equal bytes at offset %zu", cnt, ofs);
+
+        for (pos = 0; pos < cnt; pos++)
+          {
+            if (cnt > 64 && pos != 0 && pos != cnt / 2 && pos != cnt - 1)
+              continue;
+
+            /* 0x80 is greater than 0x7f as an unsigned char but
+               not as a signed one. */
+            a[ofs + pos] = 0x80;
+            b[ofs + pos] = 0x7f;
+            if (sign (memcmp (a + ofs, b + ofs, cnt)) != 1
+                || sign (memcmp (b + ofs, a + ofs, cnt)) != -1)
+              fail ("memcmp of %zu bytes at offset %zu, differing at %zu",
+                    cnt, ofs, pos);
+
+            /* A later difference does not matter. */
+            if (pos + 1 < cnt)
+              {
+                b[ofs + pos + 1] = 0xff;
+                if (sign (memcmp (a + ofs, b + ofs, cnt)) != 1)
+                  fail ("memcmp of %zu bytes at offset %zu looked past %zu",
+                        cnt, ofs, pos);
+                b[ofs + pos + 1] = a[ofs + pos + 1];
+              }
+            a[ofs + pos] = b[ofs + pos] = pattern (ofs + pos, 4);
+          }
+      }
+}
+
+/* The routines to time, as operations on two pages. */
+enum op { COPY, MOVE, SET, CMP };
+
+struct routine
+  {
+    const char *name;
+    enum op op;
+    bool bytes;                 /* Byte-at-a-time version? */
+  };
+
+static const struct routine routines[] =
+  {
+    {"memcpy", COPY, false}, {"memcpy_bytes", COPY, true},
+    {"memmove", MOVE, false}, {"memmove_bytes", MOVE, true},
+    {"memset", SET, false}, {"memset_bytes", SET, true},
+    {"memcmp", CMP, false}, {"memcmp_bytes", CMP, true},
+  };
+
+static void
+run (const struct routine *r, uint8_t *dst, uint8_t *src)
+{
+  switch (r->op)
+    {
+    case COPY:
+      (r->bytes ? memcpy_bytes : memcpy) (dst, src, PGSIZE);
+      break;
+    case MOVE:
+      (r->bytes ? memmove_bytes : memmove) (dst, src, PGSIZE);
+      break;
+    case SET:
+      (r->bytes ? memset_bytes : memset) (dst, 0, PGSIZE);
+      break;
+    case CMP:
+      (r->bytes ? memcmp_bytes : memcmp) (dst, src, PGSIZE);
+      break;
+    }
+}
+
+void
+test_string_speed (void)
+{
+  uint8_t *pages = palloc_get_multiple (0, 2);
+  uint8_t *dst = pages, *src = pages + PGSIZE;
+  size_t i;
+  int it;
+
+  ASSERT (pages != NULL);
+  check_copy_set (dst, src, CHECK_SIZE);
+  check_move (dst, CHECK_SIZE);
+  check_compare (dst, src, CHECK_SIZE);
+  msg ("memcpy, memmove, memset and memcmp results are correct.");
+
+  for (i = 0; i < ARRAY_CNT (routines); i++)
+    {
+      uint64_t best = UINT64_MAX;
+
+      fill (src, PGSIZE, i);
+      memcpy_bytes (dst, src, PGSIZE);
+      for (it = 0; it < ITERATIONS; it++)
+        {
+          uint64_t start = cycle_count ();
+          run (&routines[i], dst, src);
+          uint64_t cycles = cycle_count () - start;
+          if (cycles < best)
+            best = cycles;
+        }
+      msg ("timing: %s: %llu cycles per kB", routines[i].name,
+           (unsigned long long) best * 1024 / PGSIZE);
+    }
+
+  palloc_free_multiple (pages, 2);
+}
@@ -0,0 +1,11 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+use tests::threads::timing;
+check_timed ([<<'EOF']);
+(string-speed) begin
+(string-speed) memcpy, memmove, memset and memcmp results are correct.
+(string-speed) end
+EOF
+pass;
@@ -29,6 +29,9 @@ static const struct test tests[] =
     {"priority-preempt", test_priority_preempt},
     {"priority-sema", test_priority_sema},
     {"priority-condvar", test_priority_condvar},
+    {"priority-latency", test_priority_latency},
+    {"string-speed", test_string_speed},
+    {"bitmap-scan", test_bitmap_scan},
     {"mlfqs-load-1", test_mlfqs_load_1},
     {"mlfqs-load-60", test_mlfqs_load_60},
     {"mlfqs-load-avg", test_mlfqs_load_avg},
@@ -100,3 +103,14 @@ pass (void)
   printf ("(%s) PASS\n", test_name);
 }
 
+/* Returns the CPU's time-stamp counter.  The speed tests use it
+   only for timings that they print "timing: " lines about, since
+   cycle counts vary from one host and simulator to another. */
+uint64_t
+cycle_count (void)
+{
+  uint32_t low, high;
+  asm volatile ("rdtsc" : "=a" (low), "=d" (high));
+  return ((uint64_t) high << 32) | low;
+}
+
@@ -1,6 +1,8 @@
 #ifndef TESTS_THREADS_TESTS_H
 #define TESTS_THREADS_TESTS_H
 
+#include <stdint.h>
+
 void run_test (const char *);
 
 typedef void test_func (void);
@@ -23,6 +25,9 @@ extern test_func test_priority_fifo;
 extern test_func test_priority_preempt;
 extern test_func test_priority_sema;
 extern test_func test_priority_condvar;
+extern test_func test_priority_latency;
+extern test_func test_string_speed;
+extern test_func test_bitmap_scan;
 extern test_func test_mlfqs_load_1;
 extern test_func test_mlfqs_load_60;
 extern test_func test_mlfqs_load_avg;
@@ -36,6 +41,7 @@ extern test_func test_mlfqs_block;
 void msg (const char *, ...);
 void fail (const char *, ...);
 void pass (void);
+uint64_t cycle_count (void);
 
 #endif /* tests/threads/tests.h */
 
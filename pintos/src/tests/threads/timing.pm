@@ -0,0 +1,20 @@
+use strict;
+use warnings;
+use tests::tests;
+
+# check_timed ($EXPECTED)
+#
+# Like check_expected(), but first drops the "(test) timing: ..."
+# lines that the speed tests print for information only, since
+# their numbers depend on the host.
+sub check_timed {
+    my ($expected) = @_;
+    our ($test);
+
+    my (@output) = read_text_file ("$test.output");
+    common_checks ("run", @output);
+    @output = grep (!/^\([^)]+\) timing: /, @output);
+    compare_output ("run", \@output, $expected);
+}
+
+1;
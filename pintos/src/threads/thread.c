@@ -11,6 +11,7 @@
 #include "threads/switch.h"
 #include "threads/synch.h"
 #include "threads/vaddr.h"
+#include "devices/timer.h"
 #ifdef USERPROG
 #include "userprog/process.h"
 #endif
@@ -20,9 +21,15 @@
    of thread.h for details. */
 #define THREAD_MAGIC 0xcd6abf4b
 
-/* List of processes in THREAD_READY state, that is, processes
-   that are ready to run but not actually running. */
-static struct list ready_list;
+/* Processes in THREAD_READY state, that is, processes that are
+   ready to run but not actually running, in one FIFO queue per
+   priority.  Bit P of ready_mask is set exactly when
+   ready_queues[P] is nonempty, so the highest-priority ready
+   thread is found with a find-first-set instead of a scan, and
+   making a thread ready is a push onto its queue. */
+static struct list ready_queues[PRI_MAX + 1];
+static uint64_t ready_mask;
+static int ready_count;         /* Total threads in ready_queues. */
 
 /* List of all processes.  Processes are added to this list
    when they are first scheduled and removed when they exit. */
@@ -59,6 +66,15 @@ static unsigned thread_ticks;   /* # of timer ticks since last yield. */
    Controlled by kernel command-line option "-o mlfqs". */
 bool thread_mlfqs;
 
+/* Multi-level feedback queue scheduler state.  load_avg is the
+   system load average, updated once per second.  Between those
+   updates only the running thread's recent_cpu changes, so the
+   timer interrupt recomputes just its priority; the once-per-
+   second pass decays every thread's recent_cpu with a single
+   coefficient and moves ready threads between run queues, which
+   is O(threads) and needs no sorting. */
+static fixed_point_t load_avg;
+
 static void kernel_thread (thread_func *, void *aux);
 
 static void idle (void *aux UNUSED);
@@ -70,13 +86,19 @@ static void *alloc_frame (struct thread *, size_t size);
 static void schedule (void);
 void thread_schedule_tail (struct thread *prev);
 static tid_t allocate_tid (void);
+static void ready_push (struct thread *);
+static void ready_remove (struct thread *);
+static int ready_max_priority (void);
+static void set_effective_priority (struct thread *, int priority);
+static void mlfqs_update_priority (struct thread *);
+static void mlfqs_tick (struct thread *);
 
 /* Initializes the threading system by transforming the code
    that's currently running into a thread.  This can't work in
    general and it is possible in this case only because loader.S
    was careful to put the bottom of the stack at a page boundary.
 
-   Also initializes the run queue and the tid lock.
+   Also initializes the run queues and the tid lock.
 
    After calling this function, be sure to initialize the page
    allocator before trying to create any threads with
@@ -87,10 +109,14 @@ static tid_t allocate_tid (void);
 void
 thread_init (void)
 {
+  int pri;
+
   ASSERT (intr_get_level () == INTR_OFF);
 
   lock_init (&tid_lock);
-  list_init (&ready_list);
+  for (pri = PRI_MIN; pri <= PRI_MAX; pri++)
+    list_init (&ready_queues[pri]);
+  ready_mask = 0;
   list_init (&all_list);
 
   /* Set up a thread structure for the running thread. */
@@ -134,6 +160,9 @@ thread_tick (void)
   else
     kernel_ticks++;
 
+  if (thread_mlfqs)
+    mlfqs_tick (t);
+
   /* Enforce preemption. */
   if (++thread_ticks >= TIME_SLICE)
     intr_yield_on_return ();
@@ -159,9 +188,8 @@ thread_print_stats (void)
    scheduled.  Use a semaphore or some other form of
    synchronization if you need to ensure ordering.
 
-   The code provided sets the new thread's `priority' member to
-   PRIORITY, but no actual priority scheduling is implemented.
-   Priority scheduling is the goal of Problem 1-3. */
+   If the new thread has a higher priority than the running
+   thread, it preempts it before thread_create() returns. */
 tid_t
 thread_create (const char *name, int priority,
                thread_func *function, void *aux)
@@ -170,6 +198,7 @@ thread_create (const char *name, int priority,
   struct kernel_thread_frame *kf;
   struct switch_entry_frame *ef;
   struct switch_threads_frame *sf;
+  enum intr_level old_level;
   tid_t tid;
 
   ASSERT (function != NULL);
@@ -183,6 +212,18 @@ thread_create (const char *name, int priority,
   init_thread (t, name, priority);
   tid = t->tid = allocate_tid ();
 
+  /* Under the MLFQS a thread inherits its parent's niceness and
+     CPU usage, and its priority follows from those.  The idle
+     thread always stays at PRI_MIN. */
+  if (thread_mlfqs && function != idle)
+    {
+      t->nice = thread_current ()->nice;
+      t->recent_cpu = thread_current ()->recent_cpu;
+      old_level = intr_disable ();
+      mlfqs_update_priority (t);
+      intr_set_level (old_level);
+    }
+
   /* Stack frame for kernel_thread(). */
   kf = alloc_frame (t, sizeof *kf);
   kf->eip = NULL;
@@ -200,6 +241,7 @@ thread_create (const char *name, int priority,
 
   /* Add to run queue. */
   thread_unblock (t);
+  thread_preempt ();
 
   return tid;
 }
@@ -237,8 +279,8 @@ thread_unblock (struct thread *t)
 
   old_level = intr_disable ();
   ASSERT (t->status == THREAD_BLOCKED);
-  list_push_back (&ready_list, &t->elem);
   t->status = THREAD_READY;
+  ready_push (t);
   intr_set_level (old_level);
 }
 
@@ -307,9 +349,9 @@ thread_yield (void)
   ASSERT (!intr_context ());
 
   old_level = intr_disable ();
-  if (cur != idle_thread)
-    list_push_back (&ready_list, &cur->elem);
   cur->status = THREAD_READY;
+  if (cur != idle_thread)
+    ready_push (cur);
   schedule ();
   intr_set_level (old_level);
 }
@@ -331,11 +373,99 @@ thread_foreach (thread_action_func *func, void *aux)
     }
 }
 
-/* Sets the current thread's priority to NEW_PRIORITY. */
+/* Sets the current thread's base priority to NEW_PRIORITY.  The
+   thread keeps running at any higher priority donated to it, and
+   yields if it no longer has the highest priority.  Ignored under
+   the MLFQS, which sets priorities itself. */
 void
 thread_set_priority (int new_priority)
 {
-  thread_current ()->priority = new_priority;
+  struct thread *cur = thread_current ();
+  enum intr_level old_level;
+
+  ASSERT (PRI_MIN <= new_priority && new_priority <= PRI_MAX);
+  if (thread_mlfqs)
+    return;
+
+  old_level = intr_disable ();
+  cur->base_priority = new_priority;
+  thread_recompute_priority (cur);
+  intr_set_level (old_level);
+  thread_preempt ();
+}
+
+/* Changes T's effective priority to PRIORITY, moving it to the
+   matching run queue if it is ready.  Must be called with
+   interrupts off. */
+static void
+set_effective_priority (struct thread *t, int priority)
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  if (t->priority == priority)
+    return;
+  if (t->status == THREAD_READY)
+    {
+      ready_remove (t);
+      t->priority = priority;
+      ready_push (t);
+    }
+  else
+    t->priority = priority;
+}
+
+/* Raises T's effective priority to PRIORITY, if that is higher.
+   Used by synch.c to donate priority to a lock holder.  Must be
+   called with interrupts off. */
+void
+thread_donate_priority (struct thread *t, int priority)
+{
+  if (priority > t->priority)
+    set_effective_priority (t, priority);
+}
+
+/* Recomputes T's effective priority as the highest of its base
+   priority and the priorities of the threads waiting on locks it
+   holds.  Must be called with interrupts off. */
+void
+thread_recompute_priority (struct thread *t)
+{
+  int priority = t->base_priority;
+  struct list_elem *l, *w;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  for (l = list_begin (&t->locks_held); l != list_end (&t->locks_held);
+       l = list_next (l))
+    {
+      struct list *waiters = &list_entry (l, struct lock, elem)
+                                ->semaphore.waiters;
+      for (w = list_begin (waiters); w != list_end (waiters); w = list_next (w))
+        {
+          struct thread *waiter = list_entry (w, struct thread, elem);
+          if (waiter->priority > priority)
+            priority = waiter->priority;
+        }
+    }
+  set_effective_priority (t, priority);
+}
+
+/* Yields the CPU if a ready thread has a higher priority than the
+   running thread.  From an interrupt handler, the yield happens
+   on return from the interrupt. */
+void
+thread_preempt (void)
+{
+  enum intr_level old_level = intr_disable ();
+  bool yield = ready_max_priority () > thread_current ()->priority;
+  intr_set_level (old_level);
+
+  if (!yield)
+    return;
+  if (intr_context ())
+    intr_yield_on_return ();
+  else
+    thread_yield ();
 }
 
 /* Returns the current thread's priority. */
@@ -345,35 +475,107 @@ thread_get_priority (void)
   return thread_current ()->priority;
 }
 
-/* Sets the current thread's nice value to NICE. */
+/* Sets the current thread's nice value to NICE and recomputes
+   its priority, yielding if it no longer has the highest. */
 void
-thread_set_nice (int nice UNUSED)
+thread_set_nice (int nice)
 {
-  /* Not yet implemented. */
+  struct thread *cur = thread_current ();
+  enum intr_level old_level;
+
+  ASSERT (NICE_MIN <= nice && nice <= NICE_MAX);
+
+  old_level = intr_disable ();
+  cur->nice = nice;
+  if (thread_mlfqs)
+    mlfqs_update_priority (cur);
+  intr_set_level (old_level);
+  thread_preempt ();
 }
 
 /* Returns the current thread's nice value. */
 int
 thread_get_nice (void)
 {
-  /* Not yet implemented. */
-  return 0;
+  return thread_current ()->nice;
 }
 
 /* Returns 100 times the system load average. */
 int
 thread_get_load_avg (void)
 {
-  /* Not yet implemented. */
-  return 0;
+  enum intr_level old_level = intr_disable ();
+  int load = fix_round (fix_scale (load_avg, 100));
+  intr_set_level (old_level);
+  return load;
 }
 
 /* Returns 100 times the current thread's recent_cpu value. */
 int
 thread_get_recent_cpu (void)
 {
-  /* Not yet implemented. */
-  return 0;
+  enum intr_level old_level = intr_disable ();
+  int recent = fix_round (fix_scale (thread_current ()->recent_cpu, 100));
+  intr_set_level (old_level);
+  return recent;
+}
+
+/* Sets T's priority from its recent_cpu and nice values:
+   PRI_MAX - recent_cpu / 4 - nice * 2, clamped to the valid
+   range.  Must be called with interrupts off. */
+static void
+mlfqs_update_priority (struct thread *t)
+{
+  int priority = PRI_MAX - fix_trunc (fix_unscale (t->recent_cpu, 4))
+                 - t->nice * 2;
+
+  if (priority < PRI_MIN)
+    priority = PRI_MIN;
+  else if (priority > PRI_MAX)
+    priority = PRI_MAX;
+  t->base_priority = priority;
+  set_effective_priority (t, priority);
+}
+
+/* Decays T's recent_cpu by the coefficient *COEFF_ and
+   recomputes its priority.  Used by the per-second pass. */
+static void
+mlfqs_decay (struct thread *t, void *coeff_)
+{
+  fixed_point_t *coeff = coeff_;
+
+  if (t == idle_thread)
+    return;
+  t->recent_cpu = fix_add (fix_mul (*coeff, t->recent_cpu), fix_int (t->nice));
+  mlfqs_update_priority (t);
+}
+
+/* MLFQS bookkeeping for a timer tick while CUR is running.  Runs
+   in the timer interrupt. */
+static void
+mlfqs_tick (struct thread *cur)
+{
+  int64_t now = timer_ticks ();
+
+  if (cur != idle_thread)
+    cur->recent_cpu = fix_add (cur->recent_cpu, fix_int (1));
+
+  if (now % TIMER_FREQ == 0)
+    {
+      int ready = ready_count + (cur != idle_thread);
+      fixed_point_t twice_load, coeff;
+
+      load_avg = fix_add (fix_mul (fix_frac (59, 60), load_avg),
+                          fix_unscale (fix_int (ready), 60));
+      twice_load = fix_scale (load_avg, 2);
+      coeff = fix_div (twice_load, fix_add (twice_load, fix_int (1)));
+      thread_foreach (mlfqs_decay, &coeff);
+    }
+  else if (now % TIME_SLICE == 0 && cur != idle_thread)
+    mlfqs_update_priority (cur);
+
+  if (ready_max_priority () > cur->priority)
+    intr_yield_on_return ();
 }
 
 /* Idle thread.  Executes when no other thread is ready to run.
@@ -461,7 +663,8 @@ init_thread (struct thread *t, const char *name, int priority)
   t->status = THREAD_BLOCKED;
   strlcpy (t->name, name, sizeof t->name);
   t->stack = (uint8_t *) t + PGSIZE;
-  t->priority = priority;
+  t->priority = t->base_priority = priority;
+  list_init (&t->locks_held);
   t->magic = THREAD_MAGIC;
 
   old_level = intr_disable ();
@@ -490,10 +693,50 @@ alloc_frame (struct thread *t, size_t size)
 static struct thread *
 next_thread_to_run (void)
 {
-  if (list_empty (&ready_list))
+  struct thread *t;
+
+  if (ready_mask == 0)
     return idle_thread;
+  t = list_entry (list_front (&ready_queues[ready_max_priority ()]),
+                  struct thread, elem);
+  ready_remove (t);
+  return t;
+}
+
+/* Appends ready thread T to the queue for its priority. */
+static void
+ready_push (struct thread *t)
+{
+  list_push_back (&ready_queues[t->priority], &t->elem);
+  ready_mask |= (uint64_t) 1 << t->priority;
+  ready_count++;
+}
+
+/* Removes ready thread T from its queue. */
+static void
+ready_remove (struct thread *t)
+{
+  list_remove (&t->elem);
+  if (list_empty (&ready_queues[t->priority]))
+    ready_mask &= ~((uint64_t) 1 << t->priority);
+  ready_count--;
+}
+
+/* Returns the highest priority of any ready thread, or -1 if
+   none is ready.  The mask is split in halves so that the bit
+   scans stay single 32-bit instructions. */
+static int
+ready_max_priority (void)
+{
+  uint32_t high = ready_mask >> 32;
+  uint32_t low = ready_mask;
+
+  if (high != 0)
+    return 63 - __builtin_clz (high);
+  else if (low != 0)
+    return 31 - __builtin_clz (low);
   else
-    return list_entry (list_pop_front (&ready_list), struct thread, elem);
+    return -1;
 }
 
 /* Completes a thread switch by activating the new thread's page
@@ -553,11 +796,13 @@ static void
 schedule (void)
 {
   struct thread *cur = running_thread ();
-  struct thread *next = next_thread_to_run ();
+  struct thread *next;
   struct thread *prev = NULL;
 
   ASSERT (intr_get_level () == INTR_OFF);
   ASSERT (cur->status != THREAD_RUNNING);
+
+  next = next_thread_to_run ();
   ASSERT (is_thread (next));
 
   if (cur != next)
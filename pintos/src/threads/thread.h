@@ -26,6 +26,11 @@ typedef int tid_t;
 #define PRI_DEFAULT 31                  /* Default priority. */
 #define PRI_MAX 63                      /* Highest priority. */
 
+/* Thread niceness, for the MLFQS. */
+#define NICE_MIN -20                    /* Nicest to other threads. */
+#define NICE_DEFAULT 0                  /* Default niceness. */
+#define NICE_MAX 20                     /* Least nice. */
+
 /* A kernel thread or user process.
 
    Each thread structure is stored in its own 4 kB page.  The
@@ -76,12 +81,13 @@ typedef int tid_t;
    the `magic' member of the running thread's `struct thread' is
    set to THREAD_MAGIC.  Stack overflow will normally change this
    value, triggering the assertion. */
-/* The `elem' member has a dual purpose.  It can be an element in
-   the run queue (thread.c), or it can be an element in a
-   semaphore wait list (synch.c).  It can be used these two ways
-   only because they are mutually exclusive: only a thread in the
-   ready state is on the run queue, whereas only a thread in the
-   blocked state is on a semaphore wait list. */
+/* The `elem' member has a triple purpose.  It can be an element
+   in the run queue (thread.c), an element in a semaphore wait
+   list (synch.c), or an element in the sleep wheel
+   (devices/timer.c).  It can be used these ways only because
+   they are mutually exclusive: only a thread in the ready state
+   is on the run queue, whereas a blocked thread waits either on
+   one semaphore or in timer_sleep(), not both. */
 struct thread
   {
     /* Owned by thread.c. */
@@ -89,12 +95,22 @@ struct thread
     enum thread_status status;          /* Thread state. */
     char name[16];                      /* Name (for debugging purposes). */
     uint8_t *stack;                     /* Saved stack pointer. */
-    int priority;                       /* Priority. */
+    int priority;                       /* Priority, including donations. */
+    int base_priority;                  /* Priority set for the thread itself. */
     struct list_elem allelem;           /* List element for all threads list. */
+    int nice;                           /* Niceness, for the MLFQS. */
+    fixed_point_t recent_cpu;           /* Recent CPU use, for the MLFQS. */
+
+    /* Owned by synch.c. */
+    struct list locks_held;             /* Locks this thread holds. */
+    struct lock *waiting_for;           /* Lock this thread waits on, if any. */
 
-    /* Shared between thread.c and synch.c. */
+    /* Shared between thread.c, synch.c and devices/timer.c. */
     struct list_elem elem;              /* List element. */
 
+    /* Owned by devices/timer.c. */
+    int64_t wake_tick;                  /* Tick to wake at, if sleeping. */
+
 #ifdef USERPROG
     /* Owned by userprog/process.c. */
     uint32_t *pagedir;                  /* Page directory. */
@@ -134,6 +150,9 @@ void thread_foreach (thread_action_func *, void *);
 
 int thread_get_priority (void);
 void thread_set_priority (int);
+void thread_donate_priority (struct thread *, int);
+void thread_recompute_priority (struct thread *);
+void thread_preempt (void);
 
 int thread_get_nice (void);
 void thread_set_nice (int);